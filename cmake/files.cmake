@@ -1,9 +1,22 @@
 set(lib_src_list 
+    src/fileio/gbuffer.cpp
     src/fileio/ppm.cpp 
+    src/fileio/render_stats.cpp
+    src/fileio/checkpoint.cpp
     src/fileio/xml_scene_parser.cpp
     src/math/vec3.cpp 
     src/math/ray.cpp 
+    src/hash.cpp
+    src/light_visibility.cpp
+    src/mesh_optimizer.cpp
+    src/mesh_simplifier.cpp
+    src/progressive.cpp
+    src/rasterizer.cpp
+    src/renderer.cpp
     src/scene.cpp
+    src/shading.cpp
+    src/thread_pool.cpp
     src/triangle.cpp
 )
 set(exe_src_list src/main.cpp)
+set(scenegen_src_list tools/scene_generator.cpp)
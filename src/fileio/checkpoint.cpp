@@ -0,0 +1,198 @@
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fmt/core.h>
+#include "hash.hpp"
+
+namespace XmlRaytracer {
+
+static const char checkpoint_magic[4] = {'X', 'R', 'C', 'K'};
+static const u32 checkpoint_version = 1;
+
+// rows are stored as raw pixels
+static_assert(sizeof(PixelData) == 3);
+
+u64 Checkpoint::render_key(const Scene& scene,
+                           const std::vector<const Camera*>& cameras,
+                           const TraceOptions& options) {
+    Hasher hasher;
+    u64 geometry = scene.geometry_hash();
+    hasher.add_bytes(&geometry, sizeof(geometry));
+
+    hasher.add(scene.max_raytrace_depth);
+    hasher.add(scene.background);
+    hasher.add(scene.ambient_light);
+    for (const auto& light : scene.lights) {
+        hasher.add(light.position);
+        hasher.add(light.intensity);
+    }
+    for (const auto& material : scene.materials) {
+        hasher.add(material.id);
+        hasher.add(material.ambient);
+        hasher.add(material.diffuse);
+        hasher.add(material.specular);
+        hasher.add(material.phong_exponent);
+        hasher.add(material.mirror_reflectance);
+    }
+
+    hasher.add(options.adaptive_termination ? 1 : 0);
+    hasher.add(options.russian_roulette_depth);
+    hasher.add(options.shadow_lod);
+    hasher.add(options.lod_depth);
+    hasher.add(options.light_visibility ? 1 : 0);
+
+    for (const Camera* camera : cameras) {
+        u64 camera_hash = camera->hash();
+        hasher.add_bytes(&camera_hash, sizeof(camera_hash));
+    }
+    return hasher.state;
+}
+
+static bool write_header(FILE* fp,
+                         u64 key,
+                         const std::vector<CheckpointView>& views) {
+    u32 view_count = static_cast<u32>(views.size());
+    fwrite(checkpoint_magic, sizeof(checkpoint_magic), 1, fp);
+    fwrite(&checkpoint_version, sizeof(checkpoint_version), 1, fp);
+    fwrite(&key, sizeof(key), 1, fp);
+    fwrite(&view_count, sizeof(view_count), 1, fp);
+    for (const auto& view : views) {
+        i32 size[2] = {view.width, view.height};
+        fwrite(size, sizeof(size), 1, fp);
+    }
+    return ferror(fp) == 0;
+}
+
+static bool write_rows(FILE* fp,
+                       const std::vector<CheckpointView>& views,
+                       const std::vector<CheckpointRow>& rows) {
+    for (const auto& row : rows) {
+        const CheckpointView& view = views[row.view];
+        const size_t width = static_cast<size_t>(view.width);
+        fwrite(&row, sizeof(row), 1, fp);
+        fwrite(view.pixels + row.row * width, sizeof(PixelData), width, fp);
+    }
+    return fflush(fp) == 0 && ferror(fp) == 0;
+}
+
+bool Checkpoint::create(const std::string& file_path,
+                        u64 render_key,
+                        const std::vector<CheckpointView>& render_views) {
+    path = file_path;
+    key = render_key;
+    views = render_views;
+
+    fp = fopen(path.c_str(), "wb");
+    if (fp == NULL) {
+        fmt::print("checkpoint_create: Couldn't create checkpoint file {}\n",
+                   path);
+        return false;
+    }
+    return write_header(fp, key, views) && fflush(fp) == 0;
+}
+
+long Checkpoint::resume(const std::string& file_path,
+                        u64 render_key,
+                        const std::vector<CheckpointView>& render_views,
+                        std::vector<std::vector<u8>>& restored) {
+    FILE* in = fopen(file_path.c_str(), "rb");
+    if (in == NULL) {
+        return -1;
+    }
+
+    char magic[4];
+    u32 version = 0;
+    u64 file_key = 0;
+    u32 view_count = 0;
+    bool ok = fread(magic, sizeof(magic), 1, in) == 1 &&
+              memcmp(magic, checkpoint_magic, sizeof(magic)) == 0 &&
+              fread(&version, sizeof(version), 1, in) == 1 &&
+              version == checkpoint_version &&
+              fread(&file_key, sizeof(file_key), 1, in) == 1 &&
+              file_key == render_key &&
+              fread(&view_count, sizeof(view_count), 1, in) == 1 &&
+              view_count == render_views.size();
+    for (size_t i = 0; ok && i < render_views.size(); i++) {
+        i32 size[2] = {0, 0};
+        ok = fread(size, sizeof(size), 1, in) == 1 &&
+             size[0] == render_views[i].width &&
+             size[1] == render_views[i].height;
+    }
+    if (!ok) {
+        fclose(in);
+        return -1;
+    }
+
+    restored.resize(render_views.size());
+    for (size_t i = 0; i < render_views.size(); i++) {
+        restored[i].assign(static_cast<size_t>(render_views[i].height), 0);
+    }
+
+    // read until the end or the first record a crash cut short
+    std::vector<CheckpointRow> rows{};
+    std::vector<PixelData> buffer{};
+    CheckpointRow row{};
+    while (fread(&row, sizeof(row), 1, in) == 1) {
+        if (row.view >= render_views.size() ||
+            row.row >= static_cast<u32>(render_views[row.view].height)) {
+            break;
+        }
+        const CheckpointView& view = render_views[row.view];
+        const size_t width = static_cast<size_t>(view.width);
+        buffer.resize(width);
+        if (fread(buffer.data(), sizeof(PixelData), width, in) != width) {
+            break;
+        }
+        u8& done = restored[row.view][row.row];
+        if (!done) {
+            std::copy(
+                buffer.begin(), buffer.end(), view.pixels + row.row * width);
+            done = 1;
+            rows.push_back(row);
+        }
+    }
+    fclose(in);
+
+    // rewrite without a possibly torn tail, then keep appending to it
+    std::string tmp_path = file_path + ".tmp";
+    if (!create(tmp_path, render_key, render_views) ||
+        !write_rows(fp, views, rows) || !close() ||
+        std::rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+        fmt::print("checkpoint_resume: Couldn't rewrite checkpoint {}\n",
+                   file_path);
+        close();
+        return -1;
+    }
+    path = file_path;
+    fp = fopen(path.c_str(), "ab");
+    if (fp == NULL) {
+        return -1;
+    }
+    return static_cast<long>(rows.size());
+}
+
+bool Checkpoint::append(const std::vector<CheckpointRow>& rows) {
+    if (fp == NULL) {
+        return false;
+    }
+    return write_rows(fp, views, rows);
+}
+
+bool Checkpoint::close() {
+    if (fp == NULL) {
+        return true;
+    }
+    bool ok = ferror(fp) == 0;
+    ok = fclose(fp) == 0 && ok;
+    fp = NULL;
+    return ok;
+}
+
+bool Checkpoint::remove() {
+    close();
+    return std::remove(path.c_str()) == 0;
+}
+
+} // namespace XmlRaytracer
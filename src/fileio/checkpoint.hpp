@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "dev.h"
+#include "fileio/ppm.hpp"
+#include "scene.hpp"
+#include "shading.hpp"
+
+namespace XmlRaytracer {
+
+// Framebuffer of one view as seen by the checkpoint, top row first.
+struct CheckpointView {
+    int width, height;
+    PixelData* pixels;
+};
+
+struct CheckpointRow {
+    u32 view;
+    u32 row;
+};
+
+// Append-only file of the finished rows of a render, so a killed render can
+// resume without recomputing them. A header identifies the render, row
+// records follow in the order they finished. A record cut short by a crash
+// is dropped when the file is read.
+struct Checkpoint {
+    FILE* fp = nullptr;
+    std::string path;
+    u64 key;
+    std::vector<CheckpointView> views;
+
+    // Fingerprint of everything the pixels depend on: scene content,
+    // cameras and tracing options.
+    static u64 render_key(const Scene& scene,
+                          const std::vector<const Camera*>& cameras,
+                          const TraceOptions& options);
+
+    // Starts a new checkpoint at path, replacing any existing file.
+    bool create(const std::string& file_path,
+                u64 render_key,
+                const std::vector<CheckpointView>& render_views);
+
+    // Restores the rows of a checkpoint written for the same key and view
+    // sizes into the views' pixels and sets restored[view][row]. The file
+    // is then rewritten compactly and kept open for appending. Returns the
+    // number of restored rows, -1 if the file is missing or doesn't match.
+    long resume(const std::string& file_path,
+                u64 render_key,
+                const std::vector<CheckpointView>& render_views,
+                std::vector<std::vector<u8>>& restored);
+
+    // Appends finished rows and hands them to the OS.
+    bool append(const std::vector<CheckpointRow>& rows);
+    bool close();
+    // Closes and deletes the file once the render it protects is done.
+    bool remove();
+};
+
+} // namespace XmlRaytracer
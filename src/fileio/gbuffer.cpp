@@ -0,0 +1,204 @@
+#include "gbuffer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fmt/core.h>
+
+namespace XmlRaytracer {
+
+static const char gbuffer_magic[4] = {'X', 'R', 'G', 'B'};
+static const u32 gbuffer_version = 2;
+// records converted at a time when reading or writing
+static const size_t records_per_block = 4096;
+
+// On-disk layout of a single sample, kept free of padding so the file
+// doesn't depend on the in-memory layout of HitResult.
+struct GBufferRecord {
+    double point[3];
+    double normal[3];
+    double t;
+    i32 obj_id;
+    i32 material_id;
+    i32 is_hit;
+    u32 vertices[3];
+};
+
+void GBuffer::reset(u64 scene_geometry_hash, const Camera& camera) {
+    width = camera.nx;
+    height = camera.ny;
+    geometry_hash = scene_geometry_hash;
+    camera_hash = camera.hash();
+    samples.assign(static_cast<size_t>(width) * static_cast<size_t>(height),
+                   HitResult::no_hit());
+}
+
+bool GBuffer::matches(u64 scene_geometry_hash, const Camera& camera) const {
+    return width == camera.nx && height == camera.ny &&
+           geometry_hash == scene_geometry_hash &&
+           camera_hash == camera.hash() &&
+           samples.size() ==
+               static_cast<size_t>(width) * static_cast<size_t>(height);
+}
+
+void GBuffer::release() {
+    std::vector<HitResult>().swap(samples);
+}
+
+bool GBuffer::resolve_materials(const Scene& scene) {
+    for (auto& hr : samples) {
+        if (!hr.is_hit) {
+            continue;
+        }
+        int index = scene.material_index(hr.material_id);
+        if (index < 0) {
+            return false;
+        }
+        hr.material_index = static_cast<size_t>(index);
+    }
+    return true;
+}
+
+bool GBuffer::write(const std::string& path) const {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (fp == NULL) {
+        fmt::print("gbuffer_write: Couldn't create cache file {}\n", path);
+        return false;
+    }
+
+    i32 size[2] = {width, height};
+    fwrite(gbuffer_magic, sizeof(gbuffer_magic), 1, fp);
+    fwrite(&gbuffer_version, sizeof(gbuffer_version), 1, fp);
+    fwrite(size, sizeof(size), 1, fp);
+    fwrite(&geometry_hash, sizeof(geometry_hash), 1, fp);
+    fwrite(&camera_hash, sizeof(camera_hash), 1, fp);
+
+    // converted in blocks, so no full copy of the samples is made
+    std::vector<GBufferRecord> records(records_per_block);
+    bool written = true;
+    for (size_t first = 0; written && first < samples.size();
+         first += records.size()) {
+        size_t count = std::min(records.size(), samples.size() - first);
+        for (size_t i = 0; i < count; i++) {
+            const HitResult& hr = samples[first + i];
+            GBufferRecord& rec = records[i];
+            for (int k = 0; k < 3; k++) {
+                rec.point[k] = hr.point[k];
+                rec.normal[k] = hr.normal[k];
+            }
+            rec.t = hr.t;
+            rec.obj_id = hr.obj_id;
+            rec.material_id = hr.material_id;
+            rec.is_hit = hr.is_hit ? 1 : 0;
+            for (int k = 0; k < 3; k++) {
+                rec.vertices[k] = hr.vertices[k];
+            }
+        }
+        written =
+            fwrite(records.data(), sizeof(GBufferRecord), count, fp) == count;
+    }
+
+    fclose(fp);
+    return written;
+}
+
+// Opens a cache and checks its header against the geometry and camera,
+// the file is left positioned at the first record. A stale or foreign
+// cache is rejected here, before its possibly huge size is allocated.
+static FILE* open_cache(const std::string& path,
+                        u64 geometry_hash,
+                        const Camera& camera) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    char magic[4];
+    u32 version = 0;
+    i32 size[2] = {0, 0};
+    u64 file_geometry_hash = 0;
+    u64 file_camera_hash = 0;
+    bool ok =
+        fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, gbuffer_magic, sizeof(magic)) == 0 &&
+        fread(&version, sizeof(version), 1, fp) == 1 &&
+        version == gbuffer_version &&
+        fread(size, sizeof(size), 1, fp) == 1 &&
+        fread(&file_geometry_hash, sizeof(file_geometry_hash), 1, fp) == 1 &&
+        fread(&file_camera_hash, sizeof(file_camera_hash), 1, fp) == 1;
+    if (!ok) {
+        fmt::print("gbuffer_read: {} is not a valid G-buffer cache\n", path);
+        fclose(fp);
+        return NULL;
+    }
+
+    if (size[0] != camera.nx || size[1] != camera.ny ||
+        file_geometry_hash != geometry_hash ||
+        file_camera_hash != camera.hash()) {
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+static size_t pixel_count(const Camera& camera) {
+    return static_cast<size_t>(camera.nx) * static_cast<size_t>(camera.ny);
+}
+
+bool GBuffer::probe(const std::string& path,
+                    u64 scene_geometry_hash,
+                    const Camera& camera) {
+    FILE* fp = open_cache(path, scene_geometry_hash, camera);
+    if (fp == NULL) {
+        return false;
+    }
+    long header = ftell(fp);
+    bool complete = fseek(fp, 0, SEEK_END) == 0 &&
+                    static_cast<size_t>(ftell(fp) - header) ==
+                        pixel_count(camera) * sizeof(GBufferRecord);
+    fclose(fp);
+    return complete;
+}
+
+bool GBuffer::read(const std::string& path,
+                   u64 scene_geometry_hash,
+                   const Camera& camera) {
+    FILE* fp = open_cache(path, scene_geometry_hash, camera);
+    if (fp == NULL) {
+        return false;
+    }
+
+    width = camera.nx;
+    height = camera.ny;
+    geometry_hash = scene_geometry_hash;
+    camera_hash = camera.hash();
+    samples.resize(pixel_count(camera));
+
+    std::vector<GBufferRecord> records(records_per_block);
+    for (size_t first = 0; first < samples.size(); first += records.size()) {
+        size_t count = std::min(records.size(), samples.size() - first);
+        if (fread(records.data(), sizeof(GBufferRecord), count, fp) != count) {
+            fmt::print("gbuffer_read: {} is truncated\n", path);
+            fclose(fp);
+            release();
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            const GBufferRecord& rec = records[i];
+            HitResult& hr = samples[first + i];
+            hr.point = {rec.point[0], rec.point[1], rec.point[2]};
+            hr.normal = {rec.normal[0], rec.normal[1], rec.normal[2]};
+            hr.t = rec.t;
+            hr.obj_id = rec.obj_id;
+            hr.material_id = rec.material_id;
+            hr.is_hit = rec.is_hit != 0;
+            for (int k = 0; k < 3; k++) {
+                hr.vertices[k] = rec.vertices[k];
+            }
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+} // namespace XmlRaytracer
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include "dev.h"
+#include "scene.hpp"
+#include "triangle.hpp"
+
+namespace XmlRaytracer {
+
+// Primary-hit cache, one HitResult per pixel. Lets lighting and material
+// edits be reshaded without re-tracing primary visibility.
+struct GBuffer {
+    int width, height;
+    u64 geometry_hash;
+    u64 camera_hash;
+    std::vector<HitResult> samples;
+
+    // The geometry hash is Scene::geometry_hash(), computed once by the
+    // caller instead of per view.
+    void reset(u64 scene_geometry_hash, const Camera& camera);
+    bool matches(u64 scene_geometry_hash, const Camera& camera) const;
+    // frees the samples, clearing alone would keep their memory
+    void release();
+    // Material indices aren't cached, they follow the current materials.
+    bool resolve_materials(const Scene& scene);
+
+    bool write(const std::string& path) const;
+    // true if the file holds a complete cache for the geometry and camera,
+    // without reading its samples
+    static bool probe(const std::string& path,
+                      u64 scene_geometry_hash,
+                      const Camera& camera);
+    // false if the file is missing, invalid or cached for another scene
+    // or camera
+    bool read(const std::string& path,
+              u64 scene_geometry_hash,
+              const Camera& camera);
+};
+
+} // namespace XmlRaytracer
@@ -36,47 +36,69 @@ PixelData ImageData::operator()(int x, int y) const {
     return data;
 }
 
-bool ImageData::write_ppm(const std::string& path) {
+bool PpmWriter::open(const std::string& path,
+                     int image_width,
+                     int image_height) {
     // TODO: maybe check for existing file so we don't overwrite any important
     // thing?
-    //  FILE *fp = fopen(path.c_str(), "r");
-    //  if (fp != NULL) {
-    //      fmt::print("ppm_write_image: Couldn't create image file because a
-    //      file "
-    //                 "already exists at {}\n",
-    //                 path);
-    //      fclose(fp);
-    //      return false;
-    //  }
-
-    FILE* fp = fopen(path.c_str(), "w+");
+    fp = fopen(path.c_str(), "w+");
     if (fp == NULL) {
         fmt::print("ppm_write_image: Couldn't create image file.\n");
         return false;
     }
 
+    width = image_width;
+    height = image_height;
     fprintf(fp, "P3\n");
     fprintf(fp, "%d %d\n255\n", width, height);
-    // for (auto& pixel : pixels) {
-    //     fprintf(fp, "%u %u %u\n", pixel.r, pixel.g, pixel.b);
-    // }
-
-    reverse(pixels.begin(), pixels.end());
+    return true;
+}
 
-    for (int y = 0; y < height; y++) {
-        for (int x = width - 1; x >= 0; x--) {
-            auto& pixel = (*this)(x, y);
-            fprintf(fp, "%u %u %u\n", pixel.r, pixel.g, pixel.b);
-        }
+static char* append_channel(char* out, u8 value) {
+    if (value >= 100) {
+        *out++ = static_cast<char>('0' + value / 100);
     }
+    if (value >= 10) {
+        *out++ = static_cast<char>('0' + (value / 10) % 10);
+    }
+    *out++ = static_cast<char>('0' + value % 10);
+    return out;
+}
 
-    // for (auto it = pixels.rbegin(); it != pixels.rend(); ++it) {
-    //     auto& pixel = *it;
-    //     fprintf(fp, "%u %u %u\n", pixel.r, pixel.g, pixel.b);
-    // }
+void PpmWriter::write_row(const PixelData* row) {
+    // "255 255 255\n" is the longest possible pixel
+    buffer.resize(static_cast<size_t>(width) * 12);
+    char* out = buffer.data();
+    for (int x = 0; x < width; x++) {
+        const PixelData& pixel = row[x];
+        out = append_channel(out, pixel.r);
+        *out++ = ' ';
+        out = append_channel(out, pixel.g);
+        *out++ = ' ';
+        out = append_channel(out, pixel.b);
+        *out++ = '\n';
+    }
+    fwrite(buffer.data(), 1, static_cast<size_t>(out - buffer.data()), fp);
+}
 
+bool PpmWriter::close() {
+    bool ok = ferror(fp) == 0;
     fclose(fp);
-    return true;
+    fp = nullptr;
+    return ok;
+}
+
+bool ImageData::write_ppm(const std::string& path) {
+    PpmWriter writer{};
+    if (!writer.open(path, width, height)) {
+        return false;
+    }
+
+    for (int y = 0; y < height; y++) {
+        writer.write_row(&pixels[loc(0, y)]);
+    }
+
+    return writer.close();
 }
 
 } // namespace XmlRaytracer
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdio>
 #include <vector>
 #include <string>
 #include "dev.h"
@@ -14,6 +15,18 @@ struct PixelData {
     PixelData(Color3 color);
 };
 
+// Streams a P3 image to disk row by row, top row first.
+struct PpmWriter {
+    FILE* fp = nullptr;
+    int width, height;
+    std::string buffer;
+
+    bool open(const std::string& path, int image_width, int image_height);
+    void write_row(const PixelData* row);
+    bool close();
+};
+
+// Pixels are stored row by row starting from the top row of the image.
 struct ImageData {
     int width, height;
     std::vector<PixelData> pixels;
@@ -0,0 +1,81 @@
+#include "render_stats.hpp"
+
+#include <cstdio>
+#include <fmt/core.h>
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+namespace XmlRaytracer {
+
+long current_peak_rss_kb() {
+#ifdef __unix__
+    struct rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return usage.ru_maxrss;
+    }
+#endif
+    return 0;
+}
+
+static std::string escape_json(const std::string& str) {
+    std::string rtr{};
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            rtr.push_back('\\');
+        }
+        rtr.push_back(c);
+    }
+    return rtr;
+}
+
+bool RenderStats::write_json(const std::string& path) const {
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == NULL) {
+        fmt::print("render_stats: Couldn't create stats file {}\n", path);
+        return false;
+    }
+
+    std::string lod_json{};
+    for (const auto& level : lod_levels) {
+        lod_json += fmt::format("{}{{\"triangles\": {}, \"max_error\": {}}}",
+                                lod_json.empty() ? "" : ", ",
+                                level.triangles,
+                                level.max_error);
+    }
+
+    fmt::print(fp,
+               "{{\n"
+               "  \"scene\": \"{}\",\n"
+               "  \"threads\": {},\n"
+               "  \"views\": {},\n"
+               "  \"width\": {},\n"
+               "  \"height\": {},\n"
+               "  \"triangles\": {},\n"
+               "  \"lod_levels\": [{}],\n"
+               "  \"load_ms\": {:.3f},\n"
+               "  \"build_ms\": {:.3f},\n"
+               "  \"render_ms\": {:.3f},\n"
+               "  \"write_ms\": {:.3f},\n"
+               "  \"peak_rss_kb\": {}\n"
+               "}}\n",
+               escape_json(scene_path),
+               thread_count,
+               view_count,
+               width,
+               height,
+               triangle_count,
+               lod_json,
+               load_ms,
+               build_ms,
+               render_ms,
+               write_ms,
+               peak_rss_kb);
+
+    bool ok = ferror(fp) == 0;
+    fclose(fp);
+    return ok;
+}
+
+} // namespace XmlRaytracer
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "dev.h"
+#include "mesh_simplifier.hpp"
+
+namespace XmlRaytracer {
+
+// Per-stage timings of a single run, written out for benchmark drivers.
+struct RenderStats {
+    std::string scene_path;
+    int thread_count;
+    int view_count;
+    // resolution of the first view
+    int width, height;
+    size_t triangle_count;
+    // empty unless LOD levels were built
+    std::vector<LodLevelStats> lod_levels;
+    double load_ms;
+    double build_ms;
+    double render_ms;
+    double write_ms;
+    long peak_rss_kb;
+
+    bool write_json(const std::string& path) const;
+};
+
+// Peak resident set size of this process in KiB, 0 if unknown.
+long current_peak_rss_kb();
+
+} // namespace XmlRaytracer
@@ -32,6 +32,89 @@ static bool try_to_fill_vector_from_xml(tinyxml2::XMLElement* element,
     return true;
 }
 
+static void fill_camera_from_xml(tinyxml2::XMLElement* xml_camera,
+                                 Camera& camera) {
+    using namespace tinyxml2;
+
+    camera.id = xml_camera->IntAttribute("id", camera.id);
+    XMLElement* xml_camera_position = xml_camera->FirstChildElement("position");
+    try_to_fill_vector_from_xml(
+        xml_camera_position, camera.position, "camera>position");
+
+    XMLElement* xml_camera_gaze = xml_camera->FirstChildElement("gaze");
+    try_to_fill_vector_from_xml(xml_camera_gaze, camera.gaze, "camera>gaze");
+
+    XMLElement* xml_camera_up = xml_camera->FirstChildElement("up");
+    try_to_fill_vector_from_xml(xml_camera_up, camera.up, "camera>up");
+
+    XMLElement* xml_camera_nearplane =
+        xml_camera->FirstChildElement("nearplane");
+    if (xml_camera_nearplane) {
+        auto numbers = take_n_number(xml_camera_nearplane->GetText(), 4);
+        camera.l = numbers[0];
+        camera.r = numbers[1];
+        camera.t = numbers[2];
+        camera.b = numbers[3];
+    } else {
+        fmt::print("<camera>nearplane> tag not found in xml!\n");
+    }
+
+    XMLElement* xml_camera_neardistance =
+        xml_camera->FirstChildElement("neardistance");
+    if (xml_camera_neardistance) {
+        camera.distance = xml_camera_neardistance->DoubleText();
+    } else {
+        fmt::print("<camera>neardistance> tag not found in xml!\n");
+    }
+
+    XMLElement* xml_camera_imageresolution =
+        xml_camera->FirstChildElement("imageresolution");
+    if (xml_camera_imageresolution) {
+        auto numbers = take_n_number(xml_camera_imageresolution->GetText(), 2);
+        camera.nx = static_cast<int>(numbers[0]);
+        camera.ny = static_cast<int>(numbers[1]);
+    } else {
+        fmt::print("<camera>imageresolution> tag not found in xml!\n");
+    }
+}
+
+// Reads every <camera> child of parent, cameras may also be grouped in a
+// <cameras> element.
+static void fill_cameras_from_xml(tinyxml2::XMLElement* parent,
+                                  std::vector<Camera>& cameras) {
+    using namespace tinyxml2;
+
+    XMLElement* xml_cameras = parent->FirstChildElement("cameras");
+    if (xml_cameras) {
+        fill_cameras_from_xml(xml_cameras, cameras);
+    }
+
+    XMLElement* curr = parent->FirstChildElement("camera");
+    while (curr) {
+        Camera camera{};
+        camera.id = static_cast<int>(cameras.size()) + 1;
+        fill_camera_from_xml(curr, camera);
+        cameras.push_back(camera);
+        curr = curr->NextSiblingElement("camera");
+    }
+}
+
+// Output files are named after camera ids, so two cameras sharing one,
+// e.g. an explicit id equal to a later camera's default, would overwrite
+// each other's images.
+static bool has_unique_camera_ids(const std::vector<Camera>& cameras) {
+    for (size_t i = 0; i < cameras.size(); i++) {
+        for (size_t j = i + 1; j < cameras.size(); j++) {
+            if (cameras[i].id == cameras[j].id) {
+                fmt::print("Camera id {} is used by more than one camera\n",
+                           cameras[i].id);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 bool create_scene_from_xml(const std::string& path, Scene& scene) {
     using namespace tinyxml2;
 
@@ -61,54 +144,13 @@ bool create_scene_from_xml(const std::string& path, Scene& scene) {
     XMLElement* xml_background = xml_scene->FirstChildElement("background");
     try_to_fill_vector_from_xml(xml_background, scene.background, "background");
 
-    XMLElement* xml_camera = xml_scene->FirstChildElement("camera");
-    if (xml_camera) {
-        XMLElement* xml_camera_position =
-            xml_camera->FirstChildElement("position");
-        try_to_fill_vector_from_xml(
-            xml_camera_position, scene.camera.position, "camera>position");
-
-        XMLElement* xml_camera_gaze = xml_camera->FirstChildElement("gaze");
-        try_to_fill_vector_from_xml(
-            xml_camera_gaze, scene.camera.gaze, "camera>gaze");
-
-        XMLElement* xml_camera_up = xml_camera->FirstChildElement("up");
-        try_to_fill_vector_from_xml(
-            xml_camera_up, scene.camera.up, "camera>up");
-
-        XMLElement* xml_camera_nearplane =
-            xml_camera->FirstChildElement("nearplane");
-        if (xml_camera_nearplane) {
-            auto numbers = take_n_number(xml_camera_nearplane->GetText(), 4);
-            scene.camera.l = numbers[0];
-            scene.camera.r = numbers[1];
-            scene.camera.t = numbers[2];
-            scene.camera.b = numbers[3];
-        } else {
-            fmt::print("<camera>nearplane> tag not found in xml!\n");
-        }
-
-        XMLElement* xml_camera_neardistance =
-            xml_camera->FirstChildElement("neardistance");
-        if (xml_camera_neardistance) {
-            scene.camera.distance = xml_camera_neardistance->DoubleText();
-        } else {
-            fmt::print("<camera>neardistance> tag not found in xml!\n");
-        }
-
-        XMLElement* xml_camera_imageresolution =
-            xml_camera->FirstChildElement("imageresolution");
-        if (xml_camera_imageresolution) {
-            auto numbers =
-                take_n_number(xml_camera_imageresolution->GetText(), 2);
-            scene.camera.nx = static_cast<int>(numbers[0]);
-            scene.camera.ny = static_cast<int>(numbers[1]);
-        } else {
-            fmt::print("<camera>imageresolution> tag not found in xml!\n");
-        }
-    } else {
+    fill_cameras_from_xml(xml_scene, scene.cameras);
+    if (scene.cameras.empty()) {
         fmt::print("<camera> tag not found in xml!\n");
     }
+    if (!has_unique_camera_ids(scene.cameras)) {
+        return false;
+    }
 
     XMLElement* xml_lights = xml_scene->FirstChildElement("lights");
     if (xml_lights) {
@@ -245,6 +287,33 @@ bool create_scene_from_xml(const std::string& path, Scene& scene) {
         fmt::print("<objects> tag not found in xml!\n");
     }
 
-    return true;
+    return scene.resolve_materials();
+}
+
+bool load_cameras_from_xml(const std::string& path,
+                           std::vector<Camera>& cameras) {
+    using namespace tinyxml2;
+
+    XMLDocument doc;
+    XMLError res = doc.LoadFile(path.c_str());
+    if (res != XMLError::XML_SUCCESS) {
+        fmt::print("Camera list file {} couldn't have been loaded\n", path);
+        return false;
+    }
+
+    // either a bare <cameras> list or a scene file
+    XMLElement* root = doc.FirstChildElement("cameras");
+    if (!root) {
+        root = doc.FirstChildElement("scene");
+    }
+    if (root) {
+        fill_cameras_from_xml(root, cameras);
+    }
+
+    if (cameras.empty()) {
+        fmt::print("No <camera> found in camera list file {}\n", path);
+        return false;
+    }
+    return has_unique_camera_ids(cameras);
 }
 } // namespace XmlRaytracer
@@ -6,4 +6,8 @@ namespace XmlRaytracer {
 
 bool create_scene_from_xml(const std::string& path, Scene& scene);
 
+// Appends the cameras of a <cameras> list file, or of a scene file.
+bool load_cameras_from_xml(const std::string& path,
+                           std::vector<Camera>& cameras);
+
 } // namespace XmlRaytracer
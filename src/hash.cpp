@@ -0,0 +1,27 @@
+#include "hash.hpp"
+
+namespace XmlRaytracer {
+
+void Hasher::add_bytes(const void* data, size_t size) {
+    const u8* bytes = static_cast<const u8*>(data);
+    for (size_t i = 0; i < size; i++) {
+        state ^= bytes[i];
+        state *= 1099511628211ull;
+    }
+}
+
+void Hasher::add(int value) {
+    add_bytes(&value, sizeof(value));
+}
+
+void Hasher::add(double value) {
+    add_bytes(&value, sizeof(value));
+}
+
+void Hasher::add(const Vec3& value) {
+    add(value.x);
+    add(value.y);
+    add(value.z);
+}
+
+} // namespace XmlRaytracer
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include "dev.h"
+#include "math/vec3.hpp"
+
+namespace XmlRaytracer {
+
+// 64-bit FNV-1a, used to fingerprint scene parts for on-disk caches.
+struct Hasher {
+    u64 state = 14695981039346656037ull;
+
+    void add_bytes(const void* data, size_t size);
+    void add(int value);
+    void add(double value);
+    void add(const Vec3& value);
+};
+
+} // namespace XmlRaytracer
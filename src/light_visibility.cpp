@@ -0,0 +1,261 @@
+#include "light_visibility.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <fmt/core.h>
+#include "hash.hpp"
+
+namespace XmlRaytracer {
+
+static const char light_visibility_magic[4] = {'X', 'R', 'L', 'V'};
+static const u32 light_visibility_version = 1;
+// vertices or triangles handed to a worker at a time
+static const size_t bake_batch = 256;
+// Triangles are checked on a grid with cells of about this fraction of the
+// scene size, so shadows falling inside a large triangle are found.
+static const double bake_cell_fraction = 1.0 / 64;
+static const int max_bake_subdivisions = 32;
+
+bool is_shadowed(const Scene& scene,
+                 const Vec3& point,
+                 const Light& light,
+                 int lod,
+                 int origin_obj) {
+    Vec3 light_vector = light.position - point;
+    double light_distance = light_vector.length();
+
+    // coarse levels of the point's own mesh may pass slightly above it,
+    // Scene::hit ignores those hits
+    Ray shadow_ray{point + (light_vector * 0.0000001), light_vector};
+    HitResult hr_shadow =
+        scene.hit(shadow_ray, 0, infinity, true, lod, origin_obj);
+    double shadow_hit_distance = (hr_shadow.point - shadow_ray.o).length();
+    return hr_shadow.is_hit && shadow_hit_distance <= light_distance;
+}
+
+u64 LightVisibility::scene_key(const Scene& scene) {
+    Hasher hasher;
+    u64 geometry = scene.geometry_hash();
+    hasher.add_bytes(&geometry, sizeof(geometry));
+    for (const auto& light : scene.lights) {
+        hasher.add(light.position);
+    }
+    return hasher.state;
+}
+
+// Runs task(begin, end) over batches of [0, count) on every worker.
+static void
+parallel_batches(ThreadPool& pool,
+                 size_t count,
+                 const std::function<void(size_t, size_t)>& task) {
+    std::atomic<size_t> next_batch{0};
+    pool.run([&](int) {
+        for (size_t begin = next_batch.fetch_add(bake_batch); begin < count;
+             begin = next_batch.fetch_add(bake_batch)) {
+            task(begin, std::min(begin + bake_batch, count));
+        }
+    });
+}
+
+// True if any grid point inside the triangle disagrees with its corners,
+// which all have the given state.
+static bool has_shadow_inside(const Scene& scene,
+                              const Triangle& tri,
+                              const Light& light,
+                              bool corners_shadowed,
+                              double cell) {
+    double longest = std::max({(tri.v1 - tri.v0).length(),
+                               (tri.v2 - tri.v1).length(),
+                               (tri.v0 - tri.v2).length()});
+    int n = std::clamp(static_cast<int>(ceil(longest / cell)),
+                       2,
+                       max_bake_subdivisions);
+    Vec3 centroid = (tri.v0 + tri.v1 + tri.v2) / 3;
+
+    for (int i = 0; i <= n; i++) {
+        for (int j = 0; i + j <= n; j++) {
+            if (i == n || j == n || i + j == 0) {
+                continue; // corners
+            }
+            double a = static_cast<double>(i) / n;
+            double b = static_cast<double>(j) / n;
+            Vec3 p = a * tri.v0 + b * tri.v1 + (1 - a - b) * tri.v2;
+            // pulled slightly inside, the way shaded points are
+            p = centroid + (p - centroid) * (1 - 1e-3);
+            if (is_shadowed(scene, p, light, 0, -1) != corners_shadowed) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void LightVisibility::bake(const Scene& scene, ThreadPool& pool) {
+    key = scene_key(scene);
+    light_count = static_cast<u32>(scene.lights.size());
+    states.assign(scene.vertex_data.size() * light_count, unknown);
+
+    // only full detail geometry, LOD levels are never looked up
+    std::vector<u8> used(scene.vertex_data.size(), 0);
+    std::vector<const Vec3*> faces{};
+    Vec3 min{infinity, infinity, infinity};
+    Vec3 max{-infinity, -infinity, -infinity};
+    for (const auto& obj : scene.objects) {
+        for (const auto& face : obj.faces) {
+            faces.push_back(&face);
+            for (int k = 0; k < 3; k++) {
+                size_t vertex = static_cast<size_t>(face[k] - 1);
+                used[vertex] = 1;
+                for (int axis = 0; axis < 3; axis++) {
+                    min[axis] =
+                        std::min(min[axis], scene.vertex_data[vertex][axis]);
+                    max[axis] =
+                        std::max(max[axis], scene.vertex_data[vertex][axis]);
+                }
+            }
+        }
+    }
+    if (faces.empty()) {
+        return;
+    }
+
+    parallel_batches(pool, used.size(), [&](size_t begin, size_t end) {
+        for (size_t vertex = begin; vertex < end; vertex++) {
+            if (!used[vertex]) {
+                continue;
+            }
+            for (size_t light = 0; light < light_count; light++) {
+                bool shadowed = is_shadowed(scene,
+                                            scene.vertex_data[vertex],
+                                            scene.lights[light],
+                                            0,
+                                            -1);
+                states[vertex * light_count + light] =
+                    shadowed ? occluded : visible;
+            }
+        }
+    });
+
+    // Corners agreeing doesn't mean the inside does, a shadow can fall
+    // entirely within a large triangle. Such triangles get their corners
+    // marked unknown, which sends them to exact shadow rays.
+    const double cell = (max - min).length() * bake_cell_fraction;
+    std::vector<u8> shadow_inside(faces.size() * light_count, 0);
+    parallel_batches(pool, faces.size(), [&](size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            const Vec3& face = *faces[f];
+            size_t v0 = static_cast<size_t>(face.x - 1);
+            size_t v1 = static_cast<size_t>(face.y - 1);
+            size_t v2 = static_cast<size_t>(face.z - 1);
+            for (size_t light = 0; light < light_count; light++) {
+                u8 state = states[v0 * light_count + light];
+                if (states[v1 * light_count + light] != state ||
+                    states[v2 * light_count + light] != state) {
+                    continue; // falls back anyway
+                }
+                shadow_inside[f * light_count + light] =
+                    has_shadow_inside(scene,
+                                      scene.triangle(face),
+                                      scene.lights[light],
+                                      state == occluded,
+                                      cell);
+            }
+        }
+    });
+
+    for (size_t f = 0; f < faces.size(); f++) {
+        for (size_t light = 0; light < light_count; light++) {
+            if (!shadow_inside[f * light_count + light]) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                size_t vertex = static_cast<size_t>((*faces[f])[k] - 1);
+                states[vertex * light_count + light] = unknown;
+            }
+        }
+    }
+}
+
+bool LightVisibility::matches(const Scene& scene) const {
+    return key == scene_key(scene) && light_count == scene.lights.size() &&
+           states.size() == scene.vertex_data.size() * light_count;
+}
+
+LightVisibility::State LightVisibility::lookup(const HitResult& hr,
+                                               size_t light) const {
+    u8 state = states[hr.vertices[0] * light_count + light];
+    if (states[hr.vertices[1] * light_count + light] != state ||
+        states[hr.vertices[2] * light_count + light] != state) {
+        return unknown;
+    }
+    return static_cast<State>(state);
+}
+
+bool LightVisibility::write(const std::string& path) const {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (fp == NULL) {
+        fmt::print("light_visibility_write: Couldn't create bake file {}\n",
+                   path);
+        return false;
+    }
+
+    u64 count = states.size();
+    fwrite(light_visibility_magic, sizeof(light_visibility_magic), 1, fp);
+    fwrite(&light_visibility_version,
+           sizeof(light_visibility_version),
+           1,
+           fp);
+    fwrite(&key, sizeof(key), 1, fp);
+    fwrite(&light_count, sizeof(light_count), 1, fp);
+    fwrite(&count, sizeof(count), 1, fp);
+    size_t written = fwrite(states.data(), 1, states.size(), fp);
+
+    fclose(fp);
+    return written == states.size();
+}
+
+bool LightVisibility::read(const std::string& path, const Scene& scene) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    char magic[4];
+    u32 version = 0;
+    u64 count = 0;
+    bool ok =
+        fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, light_visibility_magic, sizeof(magic)) == 0 &&
+        fread(&version, sizeof(version), 1, fp) == 1 &&
+        version == light_visibility_version &&
+        fread(&key, sizeof(key), 1, fp) == 1 &&
+        fread(&light_count, sizeof(light_count), 1, fp) == 1 &&
+        fread(&count, sizeof(count), 1, fp) == 1;
+    if (!ok) {
+        fmt::print("light_visibility_read: {} is not a valid bake\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    // the header decides before allocating, a foreign file may claim any size
+    if (key != scene_key(scene) || light_count != scene.lights.size() ||
+        count != scene.vertex_data.size() * light_count) {
+        fclose(fp);
+        return false;
+    }
+
+    states.resize(count);
+    size_t read_count = fread(states.data(), 1, states.size(), fp);
+    fclose(fp);
+    if (read_count != states.size()) {
+        fmt::print("light_visibility_read: {} is truncated\n", path);
+        return false;
+    }
+    return true;
+}
+
+} // namespace XmlRaytracer
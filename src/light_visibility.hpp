@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "dev.h"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+namespace XmlRaytracer {
+
+// Shadow ray results baked at every vertex for every light, reused across
+// frames as long as geometry and light positions stay the same. A hit
+// whose three corners agree takes the baked result, anything else falls
+// back to an exact shadow ray. Corners of triangles with a shadow boundary
+// inside are baked as unknown.
+struct LightVisibility {
+    enum State : u8 { occluded = 0, visible = 1, unknown = 2 };
+
+    // fingerprint of geometry and light positions the bake belongs to
+    u64 key;
+    u32 light_count;
+    // vertex * light_count + light
+    std::vector<u8> states;
+
+    static u64 scene_key(const Scene& scene);
+
+    // Traces one shadow ray per light from every vertex of the meshes,
+    // then checks the inside of every triangle on a grid.
+    void bake(const Scene& scene, ThreadPool& pool);
+    bool matches(const Scene& scene) const;
+
+    // occluded or visible if all corners of the hit triangle agree
+    State lookup(const HitResult& hr, size_t light) const;
+
+    bool write(const std::string& path) const;
+    // false if the file is missing, invalid or baked for another scene
+    bool read(const std::string& path, const Scene& scene);
+};
+
+// The exact shadow test of shading, shared with the bake so both agree.
+// point lies on the mesh with Mesh::id origin_obj.
+bool is_shadowed(const Scene& scene,
+                 const Vec3& point,
+                 const Light& light,
+                 int lod,
+                 int origin_obj);
+
+} // namespace XmlRaytracer
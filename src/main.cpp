@@ -8,139 +8,236 @@
 #include "scene.hpp"
 #include "fileio/xml_scene_parser.hpp"
 #include "triangle.hpp"
+#include "fileio/gbuffer.hpp"
+#include "fileio/render_stats.hpp"
+#include "fileio/checkpoint.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
+#include "light_visibility.hpp"
+#include "shading.hpp"
+#include "progressive.hpp"
+#include "renderer.hpp"
 #include <cmath>
 #include <chrono>
-#include <future>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <string_view>
+#include <string>
 
 namespace XmlRaytracer {
 
-Color3 ray_color(const Ray& ray, const Scene& scene, int depth) {
-    if (depth > scene.max_raytrace_depth) {
-        return {0.0, 0.0, 0.0};
-    }
+// One image of a run: a camera with its framebuffer, output file and
+// optional G-buffer cache.
+struct RenderView {
+    const Camera& camera;
+    ImageData img;
+    std::string output_path;
+    // loaded or allocated when the view starts rendering, written and
+    // freed right after its last row
+    GBuffer gbuffer;
+    std::string gbuffer_path;
+    bool use_gbuffer;
+    bool reshade;
+    bool written;
+    std::vector<u8> row_done;
+    // rows restored from a checkpoint, empty if there are none
+    std::vector<u8> restored;
+};
 
-    HitResult hr = scene.hit(ray, 0, infinity, false);
-    if (!hr.is_hit) {
-        return scene.background;
+// Inserts _<id> before the extension when there is more than one view.
+std::string view_path(const std::string& path, int camera_id, size_t views) {
+    if (views == 1) {
+        return path;
     }
+    size_t slash = path.find_last_of("/\\");
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash)) {
+        dot = path.size();
+    }
+    return fmt::format(
+        "{}_{}{}", path.substr(0, dot), camera_id, path.substr(dot));
+}
 
-    const Material& material = scene.find_material(hr.material_id);
-    Vec3 calculated_light = scene.ambient_light * material.ambient;
-
-    Vec3 cam_vector = unit_vector(-ray.d);
-
-    // light calculation
-    for (const auto& light : scene.lights) {
-        Vec3 light_vector = light.position - hr.point;
-        double light_distance = light_vector.length();
-
-        // shadows
-        Ray shadow_ray{hr.point + (light_vector * 0.0000001), light_vector};
-        HitResult hr_shadow = scene.hit(shadow_ray, 0, infinity, true);
-        double shadow_hit_distance = (hr_shadow.point - shadow_ray.o).length();
-        if (hr_shadow.is_hit && shadow_hit_distance <= light_distance) {
-            continue;
-        }
-
-        // diffuse shading
-        double normal_dot_light = dot(hr.normal, light_vector);
-        double cos_theta =
-            normal_dot_light / (hr.normal.length() * light_vector.length());
-        if (normal_dot_light > 0) {
-            calculated_light +=
-                (light.intensity / (light_distance * light_distance)) *
-                cos_theta * material.diffuse;
-        }
+// Encodes and writes rows as soon as they, and every row before them, are
+// finished, so output files are complete right after the last row renders.
+// Views are written one after the other, each to its own file.
+struct StreamingWriter {
+    std::vector<RenderView>& views;
+    std::mutex mutex;
+    std::condition_variable row_finished;
 
-        // specular shading
-        Vec3 half_vector = light_vector + cam_vector;
-        half_vector /= half_vector.length();
-        double normal_dot_half = dot(hr.normal, half_vector);
-        double cos_alpha =
-            normal_dot_half / (hr.normal.length() * half_vector.length());
-        cos_alpha = pow(cos_alpha, material.phong_exponent);
-        if (normal_dot_half > 0) {
-            calculated_light +=
-                (light.intensity / (light_distance * light_distance)) *
-                cos_alpha * material.specular;
-        }
-    }
+    void mark_row_done(size_t view, int row);
+    void run();
+};
 
-    // recursive reflection
-    if (!(material.mirror_reflectance.x <= 0.0 &&
-          material.mirror_reflectance.y <= 0.0 &&
-          material.mirror_reflectance.z <= 0.0)) {
-        double cos_theta_reflect = dot(hr.normal, cam_vector) /
-                                   (hr.normal.length() * cam_vector.length());
-        Vec3 reflect_vector = (2 * hr.normal * cos_theta_reflect) - cam_vector;
-        Ray next_ray{hr.point + (reflect_vector * 0.000001), reflect_vector};
-        Color3 reflect_color = ray_color(next_ray, scene, depth + 1);
-        calculated_light += material.mirror_reflectance * reflect_color;
+void StreamingWriter::mark_row_done(size_t view, int row) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        views[view].row_done[static_cast<size_t>(row)] = 1;
     }
+    row_finished.notify_all();
+}
 
-    // clamp result in 0...255
-    for (int i = 0; i < 3; i++) {
-        if (calculated_light[i] > 255) {
-            calculated_light[i] = 255;
-        } else if (calculated_light[0] < 0) {
-            calculated_light[i] = 0;
+void StreamingWriter::run() {
+    for (auto& view : views) {
+        PpmWriter writer{};
+        bool opened =
+            writer.open(view.output_path, view.img.width, view.img.height);
+        for (int row = 0; row < view.img.height; row++) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                row_finished.wait(lock, [&view, row] {
+                    return view.row_done[static_cast<size_t>(row)] != 0;
+                });
+            }
+            if (opened) {
+                writer.write_row(&view.img.pixels[view.img.loc(0, row)]);
+            }
         }
+        view.written = opened && writer.close();
     }
-    return calculated_light;
 }
 
-struct ThreadReturn {
-    std::vector<PixelData> pixels;
-    int start;
-};
-
-ThreadReturn thread_job(const Scene& scene, int pixel_start, int pixel_end) {
-    const Camera& cam = scene.camera;
-    const Vec3& v = cam.up;
-    const Vec3& w = -cam.gaze;
-    const Vec3& u = cross(v, w);
-    const Vec3& e = cam.position;
-    const double& d = cam.distance;
-    Vec3 image_center = e + (-w * d);
-    Vec3 image_corner = image_center + cam.t * v + cam.l * u;
-
-    std::vector<PixelData> pixels{};
+// Collects finished rows and appends them to the checkpoint file every
+// interval, so a killed render loses at most that much work while the
+// file is touched rarely.
+struct CheckpointWriter {
+    Checkpoint& checkpoint;
+    std::chrono::milliseconds interval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<CheckpointRow> pending;
+    bool finished;
 
-    for (int i = pixel_start; i < pixel_end; i++) {
-        int y = i / cam.nx;
-        int x = i % cam.nx;
+    void row_finished(size_t view, int row);
+    void finish();
+    void run();
+};
 
-        double su = (x + 0.5) * ((cam.r - cam.l) / cam.nx);
-        double sv = (y + 0.5) * ((cam.t - cam.b) / cam.ny);
-        Vec3 s = image_corner + su * u - sv * v;
-        Ray ray{e, s - e};
+void CheckpointWriter::row_finished(size_t view, int row) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back({static_cast<u32>(view), static_cast<u32>(row)});
+}
 
-        Color3 color = ray_color(ray, scene, 0);
-        pixels.push_back({color});
+void CheckpointWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
     }
+    wake.notify_all();
+}
 
-    fmt::print("ThreadJob [{}...{}] out {} pixels\n",
-               pixel_start,
-               pixel_end,
-               pixels.size());
-
-    return {pixels, pixel_start};
+void CheckpointWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool done = false;
+    while (!done) {
+        wake.wait_for(lock, interval, [this] { return finished; });
+        done = finished;
+        std::vector<CheckpointRow> rows{};
+        rows.swap(pending);
+        lock.unlock();
+        if (!rows.empty() && !checkpoint.append(rows)) {
+            fmt::print("Appending to checkpoint {} failed\n",
+                       checkpoint.path);
+        }
+        lock.lock();
+    }
 }
 
 }; // namespace XmlRaytracer
 
 int main(int arg, char const* args[]) {
     auto start = std::chrono::high_resolution_clock::now();
+    const auto program_start = std::chrono::steady_clock::now();
+
+    const char* scene_xml_path = nullptr;
+    const char* gbuffer_path = nullptr;
+    const char* camera_list_path = nullptr;
+    const char* output_path = "out.ppm";
+    const char* stats_path = nullptr;
+    const char* light_bake_path = nullptr;
+    const char* checkpoint_path = nullptr;
+    int checkpoint_interval_s = 10;
+    bool resume = false;
+    int thread_count = 0;
+    bool optimize_meshes = true;
+    double weld_tolerance = 1e-6;
+    int time_budget_ms = -1;
+    bool rasterize_primary = false;
+    int lod_levels = 0;
+    double lod_ratio = 0.5;
+    XmlRaytracer::TraceOptions trace_options{};
+    for (int i = 1; i < arg; i++) {
+        std::string_view option = args[i];
+        if (option == "--gbuffer" && i + 1 < arg) {
+            gbuffer_path = args[++i];
+        } else if (option == "--cameras" && i + 1 < arg) {
+            camera_list_path = args[++i];
+        } else if (option == "--output" && i + 1 < arg) {
+            output_path = args[++i];
+        } else if (option == "--threads" && i + 1 < arg) {
+            thread_count = std::max(1, atoi(args[++i]));
+        } else if (option == "--stats-json" && i + 1 < arg) {
+            stats_path = args[++i];
+        } else if (option == "--no-mesh-optimize") {
+            optimize_meshes = false;
+        } else if (option == "--weld-tolerance" && i + 1 < arg) {
+            weld_tolerance = std::max(epsilon, atof(args[++i]));
+        } else if (option == "--time-budget" && i + 1 < arg) {
+            time_budget_ms = std::max(0, atoi(args[++i]));
+        } else if (option == "--lod-levels" && i + 1 < arg) {
+            lod_levels = std::max(0, atoi(args[++i]));
+        } else if (option == "--lod-ratio" && i + 1 < arg) {
+            lod_ratio = std::clamp(atof(args[++i]), 0.01, 1.0);
+        } else if (option == "--shadow-lod" && i + 1 < arg) {
+            trace_options.shadow_lod = std::max(0, atoi(args[++i]));
+        } else if (option == "--lod-depth" && i + 1 < arg) {
+            trace_options.lod_depth = std::max(1, atoi(args[++i]));
+        } else if (option == "--checkpoint" && i + 1 < arg) {
+            checkpoint_path = args[++i];
+        } else if (option == "--checkpoint-interval" && i + 1 < arg) {
+            checkpoint_interval_s = std::max(1, atoi(args[++i]));
+        } else if (option == "--resume") {
+            resume = true;
+        } else if (option == "--light-bake" && i + 1 < arg) {
+            light_bake_path = args[++i];
+        } else if (option == "--rasterize-primary") {
+            rasterize_primary = true;
+        } else if (option == "--no-adaptive-termination") {
+            trace_options.adaptive_termination = false;
+        } else if (option == "--russian-roulette" && i + 1 < arg) {
+            trace_options.russian_roulette_depth = atoi(args[++i]);
+        } else if (!scene_xml_path && !option.starts_with("--")) {
+            scene_xml_path = args[i];
+        } else {
+            scene_xml_path = nullptr;
+            break;
+        }
+    }
 
-    if (arg != 2) {
+    if (resume && !checkpoint_path) {
+        fmt::print("--resume needs a --checkpoint file\n");
+        return -1;
+    }
+    if (!scene_xml_path) {
         fmt::print("Correct usage of the program is: \"./program "
-                   "[path-to-scene-xml]\"");
+                   "[path-to-scene-xml] [--output path-to-ppm] "
+                   "[--cameras path-to-camera-list] "
+                   "[--threads n] [--stats-json path] [--time-budget ms] "
+                   "[--no-mesh-optimize] [--weld-tolerance distance] "
+                   "[--gbuffer path-to-cache] [--no-adaptive-termination] "
+                   "[--russian-roulette depth] [--rasterize-primary] "
+                   "[--lod-levels n] [--lod-ratio ratio] [--shadow-lod level] "
+                   "[--lod-depth depth] [--light-bake path-to-bake] "
+                   "[--checkpoint path] [--checkpoint-interval seconds] "
+                   "[--resume]\"");
         return -1;
     }
 
-    const char* scene_xml_path = args[1];
-
     using namespace XmlRaytracer;
+    using Milliseconds = std::chrono::duration<double, std::milli>;
 
     Scene scene;
     if (!create_scene_from_xml(scene_xml_path, scene)) {
@@ -149,6 +246,17 @@ int main(int arg, char const* args[]) {
         return -1;
     }
 
+    if (camera_list_path) {
+        scene.cameras.clear();
+        if (!load_cameras_from_xml(camera_list_path, scene.cameras)) {
+            return -1;
+        }
+    }
+    if (scene.cameras.empty()) {
+        fmt::print("Scene has no camera to render: {}\n", scene_xml_path);
+        return -1;
+    }
+
     auto stop = std::chrono::high_resolution_clock::now();
     std::chrono::milliseconds total_time{};
     auto duration =
@@ -158,84 +266,356 @@ int main(int arg, char const* args[]) {
                scene_xml_path,
                duration.count());
 
+    RenderStats render_stats{};
+    render_stats.scene_path = scene_xml_path;
+    render_stats.load_ms = Milliseconds(stop - start).count();
+
+    // scene preparation before rendering counts as the build stage
     start = std::chrono::high_resolution_clock::now();
 
-    ImageData img{scene.camera.nx, scene.camera.ny, {}};
+    if (optimize_meshes) {
+        MeshOptimizationStats opt =
+            XmlRaytracer::optimize_meshes(scene, weld_tolerance);
+        fmt::print("Mesh optimization: vertices {} -> {}, triangles {} -> {} "
+                   "({} degenerate), mean vertex jump {:.1f} -> {:.1f}\n",
+                   opt.vertices_before,
+                   opt.vertices_after,
+                   opt.triangles_before,
+                   opt.triangles_after,
+                   opt.degenerates_removed,
+                   opt.vertex_jump_before,
+                   opt.vertex_jump_after);
+    }
 
-    const int thread_count =
-        static_cast<int>(std::thread::hardware_concurrency());
-    const int pixel_count = scene.camera.nx * scene.camera.ny;
-    const int pixel_per_thread = pixel_count / thread_count;
-    const int pixel_left_over = pixel_count % thread_count;
-    fmt::print("Thread count: {}\n", thread_count);
-    fmt::print("Pixel count: {}\n", pixel_count);
-    fmt::print("Pixel per thread: {}\n", pixel_per_thread);
-    fmt::print("Pixel left over: {}\n", pixel_left_over);
+    if (lod_levels > 0) {
+        LodStats lod = build_lods(scene, lod_levels, lod_ratio);
+        for (size_t level = 0; level < lod.levels.size(); level++) {
+            const LodLevelStats& level_stats = lod.levels[level];
+            fmt::print("LOD level {}: {} of {} triangles ({:.1f}%), max "
+                       "error {:.6g}\n",
+                       level + 1,
+                       level_stats.triangles,
+                       lod.triangles,
+                       100.0 * static_cast<double>(level_stats.triangles) /
+                           static_cast<double>(std::max<size_t>(
+                               1, lod.triangles)),
+                       level_stats.max_error);
+        }
+        render_stats.lod_levels = lod.levels;
+    }
 
-    std::mutex mutex;
-    std::condition_variable cond_vars;
-
-    std::vector<std::future<ThreadReturn>> futures{};
-    for (int i = 0; i + pixel_per_thread <= pixel_count - pixel_left_over;
-         i += pixel_per_thread) {
-        fmt::print(
-            "Creating thread for pixels [{}...{}]\n", i, i + pixel_per_thread);
-        auto future =
-            std::async(std::launch::async,
-                       [pixel_per_thread, i, &scene]() -> ThreadReturn {
-                           return thread_job(scene, i, i + pixel_per_thread);
-                       });
-        futures.push_back(std::move(future));
-    }
-
-    fmt::print("Processing left-over pixels [{}...{}]\n",
-               pixel_count - pixel_left_over,
-               pixel_count);
-    auto left_over_data =
-        thread_job(scene, pixel_count - pixel_left_over, pixel_count);
+    render_stats.triangle_count = 0;
+    for (const auto& obj : scene.objects) {
+        render_stats.triangle_count += obj.faces.size();
+    }
 
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-        cond_vars.wait(lock, [&futures, &thread_count] {
-            return futures.size() == static_cast<size_t>(thread_count);
-        });
+    // filled once the renderer's thread pool exists
+    LightVisibility light_visibility{};
+    if (light_bake_path) {
+        trace_options.light_visibility = &light_visibility;
+    }
+
+    RenderOptions render_options{};
+    render_options.thread_count = thread_count;
+    render_options.rasterize_primary = rasterize_primary;
+    render_options.trace = trace_options;
+    Renderer renderer{scene, render_options};
+    if (!renderer.valid()) {
+        return -1;
+    }
+
+    if (light_bake_path) {
+        if (light_visibility.read(light_bake_path, scene)) {
+            fmt::print("Light visibility bake {} is valid, reusing it\n",
+                       light_bake_path);
+        } else {
+            auto bake_start = std::chrono::high_resolution_clock::now();
+            light_visibility.bake(scene, renderer.thread_pool());
+            auto bake_stop = std::chrono::high_resolution_clock::now();
+            fmt::print("Baked light visibility of {} vertices and {} lights "
+                       "in {:.0f}ms\n",
+                       scene.vertex_data.size(),
+                       scene.lights.size(),
+                       Milliseconds(bake_stop - bake_start).count());
+            if (light_visibility.write(light_bake_path)) {
+                fmt::print("Light visibility bake written to {}\n",
+                           light_bake_path);
+            }
+        }
     }
 
-    std::vector<ThreadReturn> results{};
-    for (auto& future : futures) {
-        ThreadReturn res = future.get();
-        results.push_back(res);
+    if (time_budget_ms >= 0) {
+        // the budget covers the whole run, loading included
+        auto deadline =
+            program_start + std::chrono::milliseconds(time_budget_ms);
+        stop = std::chrono::high_resolution_clock::now();
+        render_stats.build_ms = Milliseconds(stop - start).count();
+
+        start = std::chrono::high_resolution_clock::now();
+        if (scene.cameras.size() > 1) {
+            fmt::print("Time budget previews only render the first camera\n");
+        }
+        if (checkpoint_path) {
+            fmt::print("Time budget previews don't write checkpoints\n");
+        }
+        if (gbuffer_path) {
+            fmt::print("Time budget previews don't use G-buffer caches\n");
+        }
+        if (rasterize_primary) {
+            fmt::print("Time budget previews don't rasterize primary rays\n");
+        }
+        const Camera& camera = scene.cameras.front();
+        ProgressiveResult result = render_progressive(scene,
+                                                      camera,
+                                                      trace_options,
+                                                      renderer.thread_pool(),
+                                                      deadline,
+                                                      output_path);
+        stop = std::chrono::high_resolution_clock::now();
+        render_stats.render_ms = Milliseconds(stop - start).count();
+        render_stats.write_ms = 0;
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - program_start);
+        // the first pass can't be aborted, so the budget may be overrun
+        const auto overrun = elapsed.count() - time_budget_ms;
+        fmt::print("Reached 1/{} resolution in {} passes after {}ms with a "
+                   "{}ms budget{}\n",
+                   result.step_reached,
+                   result.passes_completed,
+                   elapsed.count(),
+                   time_budget_ms,
+                   overrun > 0 ? fmt::format(", {}ms over", overrun) : "");
+
+        if (stats_path) {
+            render_stats.thread_count = renderer.thread_pool().size();
+            render_stats.view_count = 1;
+            render_stats.width = camera.nx;
+            render_stats.height = camera.ny;
+            render_stats.peak_rss_kb = current_peak_rss_kb();
+            if (!render_stats.write_json(stats_path)) {
+                return -1;
+            }
+        }
+        return result.passes_completed > 0 ? 0 : -1;
     }
 
-    sort(results.begin(),
-         results.end(),
-         [](const ThreadReturn& a, const ThreadReturn& b) -> bool {
-             return a.start < b.start;
-         });
+    // hashed once, every view's G-buffer is checked against it
+    const u64 geometry_hash = gbuffer_path ? scene.geometry_hash() : 0;
+    std::vector<RenderView> views{};
+    views.reserve(scene.cameras.size());
+    for (const auto& camera : scene.cameras) {
+        const size_t pixel_count = static_cast<size_t>(camera.nx * camera.ny);
+        RenderView view{camera,
+                        {camera.nx,
+                         camera.ny,
+                         std::vector<PixelData>(pixel_count)},
+                        view_path(output_path, camera.id, scene.cameras.size()),
+                        {},
+                        {},
+                        gbuffer_path != nullptr,
+                        false,
+                        false,
+                        std::vector<u8>(static_cast<size_t>(camera.ny), 0),
+                        {}};
+
+        if (view.use_gbuffer) {
+            view.gbuffer_path =
+                view_path(gbuffer_path, camera.id, scene.cameras.size());
+            view.reshade =
+                GBuffer::probe(view.gbuffer_path, geometry_hash, camera);
+            if (view.reshade) {
+                fmt::print("G-buffer cache {} is valid, reshading only\n",
+                           view.gbuffer_path);
+            } else {
+                fmt::print("G-buffer cache {} is missing or stale, tracing "
+                           "primary visibility\n",
+                           view.gbuffer_path);
+            }
+        }
+        views.push_back(std::move(view));
+    }
 
-    for (auto& res : results) {
-        for (auto& pixel : res.pixels) {
-            img.pixels.push_back(pixel);
+    Checkpoint checkpoint{};
+    if (checkpoint_path) {
+        std::vector<CheckpointView> checkpoint_views{};
+        std::vector<const Camera*> cameras{};
+        int total_rows = 0;
+        for (auto& view : views) {
+            checkpoint_views.push_back(
+                {view.img.width, view.img.height, view.img.pixels.data()});
+            cameras.push_back(&view.camera);
+            total_rows += view.img.height;
         }
+        u64 key = Checkpoint::render_key(scene, cameras, trace_options);
+
+        long restored = -1;
+        std::vector<std::vector<u8>> restored_rows{};
+        if (resume) {
+            restored = checkpoint.resume(
+                checkpoint_path, key, checkpoint_views, restored_rows);
+            if (restored < 0) {
+                fmt::print("Checkpoint {} is missing or belongs to another "
+                           "render, starting over\n",
+                           checkpoint_path);
+            } else {
+                fmt::print("Resumed {} of {} rows from checkpoint {}\n",
+                           restored,
+                           total_rows,
+                           checkpoint_path);
+            }
+        }
+
+        if (restored < 0) {
+            if (!checkpoint.create(checkpoint_path, key, checkpoint_views)) {
+                return -1;
+            }
+        } else {
+            for (size_t i = 0; i < views.size(); i++) {
+                views[i].restored = std::move(restored_rows[i]);
+                views[i].row_done = views[i].restored;
+            }
+        }
+    }
+
+    stop = std::chrono::high_resolution_clock::now();
+    render_stats.build_ms = Milliseconds(stop - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+
+    std::vector<RenderTarget> targets{};
+    for (auto& view : views) {
+        targets.push_back({&view.camera,
+                           view.img.pixels.data(),
+                           view.use_gbuffer ? &view.gbuffer : nullptr,
+                           view.reshade,
+                           view.restored.empty() ? nullptr
+                                                 : view.restored.data()});
+    }
+
+    fmt::print("Thread count: {}\n", renderer.thread_pool().size());
+    fmt::print("View count: {}\n", views.size());
+
+    StreamingWriter writer{views, {}, {}};
+    std::thread writer_thread(&StreamingWriter::run, &writer);
+
+    CheckpointWriter checkpoint_writer{
+        checkpoint, std::chrono::seconds(checkpoint_interval_s), {}, {}, {},
+        false};
+    std::thread checkpoint_thread{};
+    if (checkpoint_path) {
+        checkpoint_thread =
+            std::thread(&CheckpointWriter::run, &checkpoint_writer);
+    }
+
+    // rows each view still has to render, the worker finishing the last
+    // one writes and frees the view's G-buffer
+    std::vector<std::atomic<int>> rows_left(views.size());
+    for (size_t i = 0; i < views.size(); i++) {
+        const auto& restored = views[i].restored;
+        rows_left[i] = views[i].img.height -
+                       static_cast<int>(std::count(
+                           restored.begin(), restored.end(), u8{1}));
     }
-    for (auto& pixel : left_over_data.pixels) {
-        img.pixels.push_back(pixel);
+
+    RenderCallbacks callbacks{};
+    callbacks.target_started = [&](size_t index) {
+        RenderView& view = views[index];
+        if (!view.use_gbuffer) {
+            return;
+        }
+        const Camera& camera = view.camera;
+        if (view.reshade &&
+            !(view.gbuffer.read(view.gbuffer_path, geometry_hash, camera) &&
+              view.gbuffer.resolve_materials(scene))) {
+            fmt::print("G-buffer cache {} can't be reshaded, tracing primary "
+                       "visibility\n",
+                       view.gbuffer_path);
+            view.reshade = false;
+            targets[index].reshade = false;
+        }
+        if (!view.reshade) {
+            view.gbuffer.reset(geometry_hash, camera);
+        }
+    };
+    callbacks.row_finished = [&](size_t index, int row) {
+        writer.mark_row_done(index, row);
+        RenderView& view = views[index];
+        if (view.use_gbuffer && --rows_left[index] == 0) {
+            // resumed rows were never traced, so their samples are missing
+            if (!view.reshade && view.restored.empty() &&
+                view.gbuffer.write(view.gbuffer_path)) {
+                fmt::print("G-buffer cache written to {}\n",
+                           view.gbuffer_path);
+            }
+            view.gbuffer.release();
+        }
+        if (checkpoint_path) {
+            checkpoint_writer.row_finished(index, row);
+        }
+    };
+    RenderResult result = renderer.render(targets, callbacks);
+    TraceStats trace_stats = result.stats;
+
+    if (checkpoint_path) {
+        checkpoint_writer.finish();
+        checkpoint_thread.join();
     }
 
     stop = std::chrono::high_resolution_clock::now();
     duration =
         std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
     total_time += duration;
+    render_stats.render_ms = Milliseconds(stop - start).count();
     fmt::print("Rendering took: {}ms\n", duration.count());
+    fmt::print("Reflection rays skipped: {} by throughput, {} by russian "
+               "roulette\n",
+               trace_stats.adaptive_terminated,
+               trace_stats.roulette_terminated);
+    if (light_bake_path) {
+        fmt::print("Primary hit light samples: {} from the bake, {} traced "
+                   "near shadow boundaries\n",
+                   trace_stats.visibility_baked,
+                   trace_stats.visibility_fallbacks);
+    }
 
     start = std::chrono::high_resolution_clock::now();
-    img.write_ppm("out.ppm");
+    writer_thread.join();
     stop = std::chrono::high_resolution_clock::now();
     duration =
         std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
     total_time += duration;
-    fmt::print("Writing PPM file took: {}ms\n", duration.count());
+    render_stats.write_ms = Milliseconds(stop - start).count();
+    bool written = true;
+    for (const auto& view : views) {
+        if (!view.written) {
+            fmt::print("Writing PPM file {} failed\n", view.output_path);
+            written = false;
+        }
+    }
+    if (!written) {
+        return -1;
+    }
+    fmt::print("Writing PPM files finished {}ms after rendering\n",
+               duration.count());
+
+    // the output is complete, nothing left to resume
+    if (checkpoint_path) {
+        checkpoint.remove();
+    }
+
     fmt::print("Total program execution time: {}ms\n", total_time.count());
 
+    if (stats_path) {
+        render_stats.thread_count = renderer.thread_pool().size();
+        render_stats.view_count = static_cast<int>(views.size());
+        render_stats.width = views.front().img.width;
+        render_stats.height = views.front().img.height;
+        render_stats.peak_rss_kb = current_peak_rss_kb();
+        if (!render_stats.write_json(stats_path)) {
+            return -1;
+        }
+    }
+
     return 0;
 }
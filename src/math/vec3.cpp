@@ -95,4 +95,8 @@ double cos_between(const Vec3& u, const Vec3& v) {
     return rtr;
 }
 
+double max_component(const Vec3& v) {
+    return fmax(v.x, fmax(v.y, v.z));
+}
+
 } // namespace XmlRaytracer
@@ -33,5 +33,6 @@ Vec3 cross(const Vec3& u, const Vec3& v);
 Vec3 unit_vector(Vec3 v);
 
 double cos_between(const Vec3& u, const Vec3& v);
+double max_component(const Vec3& v);
 
 } // namespace XmlRaytracer
\ No newline at end of file
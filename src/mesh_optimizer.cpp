@@ -0,0 +1,211 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+#include "triangle.hpp"
+
+namespace XmlRaytracer {
+
+struct WeldCell {
+    i64 x, y, z;
+
+    bool operator==(const WeldCell& other) const {
+        return x == other.x && y == other.y && z == other.z;
+    }
+};
+
+struct WeldCellHash {
+    size_t operator()(const WeldCell& cell) const {
+        u64 h = static_cast<u64>(cell.x) * 73856093ull;
+        h ^= static_cast<u64>(cell.y) * 19349663ull;
+        h ^= static_cast<u64>(cell.z) * 83492791ull;
+        return static_cast<size_t>(h);
+    }
+};
+
+static size_t face_index(const Vec3& face, int k) {
+    return static_cast<size_t>(face[k] - 1);
+}
+
+static double mean_vertex_jump(const Scene& scene) {
+    double total = 0;
+    size_t jumps = 0;
+    for (const auto& obj : scene.objects) {
+        bool first = true;
+        double prev = 0;
+        for (const auto& face : obj.faces) {
+            for (int k = 0; k < 3; k++) {
+                if (!first) {
+                    total += fabs(face[k] - prev);
+                    jumps++;
+                }
+                prev = face[k];
+                first = false;
+            }
+        }
+    }
+    return jumps ? total / static_cast<double>(jumps) : 0.0;
+}
+
+// Maps every vertex to the first vertex within tolerance of it. Only the
+// 27 grid cells around a vertex can hold such a vertex.
+static std::vector<size_t> weld_vertices(const std::vector<Vec3>& vertices,
+                                         double tolerance) {
+    std::unordered_map<WeldCell, std::vector<size_t>, WeldCellHash> grid{};
+    std::vector<size_t> remap(vertices.size());
+
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const Vec3& v = vertices[i];
+        WeldCell cell{static_cast<i64>(std::floor(v.x / tolerance)),
+                      static_cast<i64>(std::floor(v.y / tolerance)),
+                      static_cast<i64>(std::floor(v.z / tolerance))};
+
+        size_t match = i;
+        for (i64 dx = -1; dx <= 1 && match == i; dx++) {
+            for (i64 dy = -1; dy <= 1 && match == i; dy++) {
+                for (i64 dz = -1; dz <= 1 && match == i; dz++) {
+                    WeldCell neighbour{cell.x + dx, cell.y + dy, cell.z + dz};
+                    auto it = grid.find(neighbour);
+                    if (it == grid.end()) {
+                        continue;
+                    }
+                    for (size_t candidate : it->second) {
+                        if ((vertices[candidate] - v).length() <= tolerance) {
+                            match = candidate;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        remap[i] = match;
+        if (match == i) {
+            grid[cell].push_back(i);
+        }
+    }
+
+    return remap;
+}
+
+static bool is_degenerate(const Triangle& tri) {
+    double longest = std::max({(tri.v1 - tri.v0).length(),
+                               (tri.v2 - tri.v1).length(),
+                               (tri.v0 - tri.v2).length()});
+    return tri.area() <= epsilon * longest * longest;
+}
+
+// Interleaves the low 21 bits of v with two zero bits each.
+static u64 spread_bits(u64 v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+static u64 morton_code(const Vec3& p, const Vec3& min, const Vec3& extent) {
+    const double cells = 2097151.0; // 2^21 - 1
+    u64 code = 0;
+    for (int k = 0; k < 3; k++) {
+        double n = extent[k] > 0 ? (p[k] - min[k]) / extent[k] : 0.0;
+        u64 q = static_cast<u64>(std::clamp(n, 0.0, 1.0) * cells);
+        code |= spread_bits(q) << k;
+    }
+    return code;
+}
+
+MeshOptimizationStats optimize_meshes(Scene& scene, double weld_tolerance) {
+    MeshOptimizationStats stats{};
+    stats.vertices_before = scene.vertex_data.size();
+    stats.vertex_jump_before = mean_vertex_jump(scene);
+
+    std::vector<size_t> weld = weld_vertices(scene.vertex_data, weld_tolerance);
+
+    Vec3 min{infinity, infinity, infinity};
+    Vec3 max{-infinity, -infinity, -infinity};
+    for (auto& obj : scene.objects) {
+        stats.triangles_before += obj.faces.size();
+
+        std::vector<Vec3> faces{};
+        faces.reserve(obj.faces.size());
+        for (const auto& face : obj.faces) {
+            size_t a = weld[face_index(face, 0)];
+            size_t b = weld[face_index(face, 1)];
+            size_t c = weld[face_index(face, 2)];
+            Triangle tri{scene.vertex_data[a],
+                         scene.vertex_data[b],
+                         scene.vertex_data[c]};
+            if (a == b || b == c || c == a || is_degenerate(tri)) {
+                stats.degenerates_removed++;
+                continue;
+            }
+            faces.push_back({static_cast<double>(a + 1),
+                             static_cast<double>(b + 1),
+                             static_cast<double>(c + 1)});
+            for (const Vec3& v : {tri.v0, tri.v1, tri.v2}) {
+                for (int k = 0; k < 3; k++) {
+                    min[k] = std::min(min[k], v[k]);
+                    max[k] = std::max(max[k], v[k]);
+                }
+            }
+        }
+        obj.faces = std::move(faces);
+        stats.triangles_after += obj.faces.size();
+    }
+
+    // sort triangles of every mesh by the morton code of their centroid
+    Vec3 extent = max - min;
+    for (auto& obj : scene.objects) {
+        std::vector<u64> codes(obj.faces.size());
+        for (size_t i = 0; i < obj.faces.size(); i++) {
+            const Vec3& face = obj.faces[i];
+            Vec3 centroid = (scene.vertex_data[face_index(face, 0)] +
+                             scene.vertex_data[face_index(face, 1)] +
+                             scene.vertex_data[face_index(face, 2)]) /
+                            3;
+            codes[i] = morton_code(centroid, min, extent);
+        }
+
+        std::vector<size_t> order(obj.faces.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return codes[a] < codes[b];
+        });
+
+        std::vector<Vec3> faces{};
+        faces.reserve(obj.faces.size());
+        for (size_t i : order) {
+            faces.push_back(obj.faces[i]);
+        }
+        obj.faces = std::move(faces);
+    }
+
+    // lay vertices out in the order triangles first reference them
+    const size_t unused = scene.vertex_data.size();
+    std::vector<size_t> new_index(scene.vertex_data.size(), unused);
+    std::vector<Vec3> vertex_data{};
+    for (auto& obj : scene.objects) {
+        for (auto& face : obj.faces) {
+            for (int k = 0; k < 3; k++) {
+                size_t old_index = face_index(face, k);
+                if (new_index[old_index] == unused) {
+                    new_index[old_index] = vertex_data.size();
+                    vertex_data.push_back(scene.vertex_data[old_index]);
+                }
+                face[k] = static_cast<double>(new_index[old_index] + 1);
+            }
+        }
+    }
+    scene.vertex_data = std::move(vertex_data);
+
+    stats.vertices_after = scene.vertex_data.size();
+    stats.vertex_jump_after = mean_vertex_jump(scene);
+    return stats;
+}
+
+} // namespace XmlRaytracer
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "scene.hpp"
+
+namespace XmlRaytracer {
+
+struct MeshOptimizationStats {
+    size_t vertices_before, vertices_after;
+    size_t triangles_before, triangles_after;
+    size_t degenerates_removed;
+    // mean distance in vertex_data between the vertices of consecutive
+    // triangles, lower means better memory locality
+    double vertex_jump_before, vertex_jump_after;
+};
+
+// Welds vertices closer than weld_tolerance, drops zero-area triangles and
+// reorders triangles and vertices along a Morton curve so that spatially
+// close triangles sit close in memory. Unreferenced vertices are dropped.
+MeshOptimizationStats optimize_meshes(Scene& scene, double weld_tolerance);
+
+} // namespace XmlRaytracer
@@ -0,0 +1,374 @@
+#include "mesh_simplifier.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+namespace XmlRaytracer {
+
+static double det3(double a, double b, double c,
+                   double d, double e, double f,
+                   double g, double h, double i) {
+    return a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+}
+
+// Sum of squared distances to a set of planes, the symmetric 4x4 matrix of
+// Garland and Heckbert stored as its upper triangle.
+struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+    void add_plane(const Vec3& n, double d) {
+        a2 += n.x * n.x;
+        ab += n.x * n.y;
+        ac += n.x * n.z;
+        ad += n.x * d;
+        b2 += n.y * n.y;
+        bc += n.y * n.z;
+        bd += n.y * d;
+        c2 += n.z * n.z;
+        cd += n.z * d;
+        d2 += d * d;
+    }
+
+    Quadric& operator+=(const Quadric& o) {
+        a2 += o.a2;
+        ab += o.ab;
+        ac += o.ac;
+        ad += o.ad;
+        b2 += o.b2;
+        bc += o.bc;
+        bd += o.bd;
+        c2 += o.c2;
+        cd += o.cd;
+        d2 += o.d2;
+        return *this;
+    }
+
+    double error(const Vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+               b2 * y * y + 2 * bc * y * z + 2 * bd * y + c2 * z * z +
+               2 * cd * z + d2;
+    }
+
+    // Point of least error, false if the quadric is (nearly) singular.
+    bool minimizer(Vec3& p) const {
+        double det = det3(a2, ab, ac, ab, b2, bc, ac, bc, c2);
+        if (fabs(det) < 1e-12) {
+            return false;
+        }
+        p.x = det3(-ad, ab, ac, -bd, b2, bc, -cd, bc, c2) / det;
+        p.y = det3(a2, -ad, ac, ab, -bd, bc, ac, -cd, c2) / det;
+        p.z = det3(a2, ab, -ad, ab, b2, -bd, ac, bc, -cd) / det;
+        return true;
+    }
+};
+
+struct Collapse {
+    double cost;
+    u32 keep, remove;
+    u32 keep_stamp, remove_stamp;
+    Vec3 target;
+
+    bool operator>(const Collapse& other) const {
+        return cost > other.cost;
+    }
+};
+
+// Edge collapse state of a single mesh, in mesh-local vertex indices.
+struct MeshSimplifier {
+    std::vector<Vec3> positions;
+    // vertex_data index of every local vertex at its current position,
+    // the original one until it moves and a snapshot appends it
+    std::vector<size_t> index;
+    std::vector<Quadric> quadrics;
+    std::vector<u32> stamps;
+    // moved is set for vertices that moved since the last snapshot
+    std::vector<u8> locked, removed, moved;
+    std::vector<std::array<u32, 3>> faces;
+    std::vector<u8> face_removed;
+    std::vector<std::vector<u32>> vertex_faces;
+    size_t alive_faces = 0;
+    double max_cost = 0;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>>
+        heap;
+
+    MeshSimplifier(const Scene& scene, const Mesh& mesh);
+
+    bool has_vertex(u32 face, u32 vertex) const;
+    void neighbours(u32 vertex, std::vector<u32>& out) const;
+    void push_edge(u32 a, u32 b);
+    bool collapse(const Collapse& c);
+    void simplify_to(size_t target_faces);
+    std::vector<Vec3> snapshot(std::vector<Vec3>& vertex_data);
+};
+
+MeshSimplifier::MeshSimplifier(const Scene& scene, const Mesh& mesh) {
+    std::unordered_map<size_t, u32> local{};
+    auto local_index = [&](double face_index) {
+        size_t vertex = static_cast<size_t>(face_index - 1);
+        auto [it, inserted] =
+            local.try_emplace(vertex, static_cast<u32>(positions.size()));
+        if (inserted) {
+            positions.push_back(scene.vertex_data[vertex]);
+            index.push_back(vertex);
+        }
+        return it->second;
+    };
+
+    for (const auto& face : mesh.faces) {
+        std::array<u32, 3> f{
+            local_index(face.x), local_index(face.y), local_index(face.z)};
+        if (f[0] != f[1] && f[1] != f[2] && f[2] != f[0]) {
+            faces.push_back(f);
+        }
+    }
+
+    const size_t vertex_count = positions.size();
+    quadrics.assign(vertex_count, Quadric{});
+    stamps.assign(vertex_count, 0);
+    locked.assign(vertex_count, 0);
+    removed.assign(vertex_count, 0);
+    moved.assign(vertex_count, 0);
+    vertex_faces.resize(vertex_count);
+    face_removed.assign(faces.size(), 0);
+    alive_faces = faces.size();
+
+    std::unordered_map<u64, int> edge_faces{};
+    for (u32 f = 0; f < faces.size(); f++) {
+        const auto& face = faces[f];
+        Vec3 n = cross(positions[face[1]] - positions[face[0]],
+                       positions[face[2]] - positions[face[0]]);
+        double length = n.length();
+        for (size_t k = 0; k < 3; k++) {
+            vertex_faces[face[k]].push_back(f);
+            if (length > 0) {
+                quadrics[face[k]].add_plane(
+                    n / length, -dot(n / length, positions[face[0]]));
+            }
+            u32 a = std::min(face[k], face[(k + 1) % 3]);
+            u32 b = std::max(face[k], face[(k + 1) % 3]);
+            edge_faces[static_cast<u64>(a) << 32 | b]++;
+        }
+    }
+
+    // boundary and non-manifold edges keep their vertices in place
+    for (const auto& [edge, count] : edge_faces) {
+        if (count != 2) {
+            locked[edge >> 32] = 1;
+            locked[edge & 0xffffffff] = 1;
+        }
+    }
+    for (const auto& [edge, count] : edge_faces) {
+        push_edge(static_cast<u32>(edge >> 32),
+                  static_cast<u32>(edge & 0xffffffff));
+    }
+}
+
+bool MeshSimplifier::has_vertex(u32 face, u32 vertex) const {
+    const auto& f = faces[face];
+    return f[0] == vertex || f[1] == vertex || f[2] == vertex;
+}
+
+void MeshSimplifier::neighbours(u32 vertex, std::vector<u32>& out) const {
+    out.clear();
+    for (u32 f : vertex_faces[vertex]) {
+        if (face_removed[f]) {
+            continue;
+        }
+        for (u32 v : faces[f]) {
+            if (v != vertex) {
+                out.push_back(v);
+            }
+        }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void MeshSimplifier::push_edge(u32 a, u32 b) {
+    if (locked[a] && locked[b]) {
+        return;
+    }
+    if (locked[b]) {
+        std::swap(a, b);
+    }
+
+    Quadric q = quadrics[a];
+    q += quadrics[b];
+
+    Vec3 target = positions[a];
+    if (!locked[a]) {
+        // the minimizer of a badly conditioned quadric can lie far off
+        Vec3 mid = (positions[a] + positions[b]) / 2;
+        double edge_length = (positions[a] - positions[b]).length();
+        if (!q.minimizer(target) || (target - mid).length() > edge_length) {
+            target = mid;
+            for (const Vec3& candidate : {positions[a], positions[b]}) {
+                if (q.error(candidate) < q.error(target)) {
+                    target = candidate;
+                }
+            }
+        }
+    }
+
+    heap.push({std::max(0.0, q.error(target)),
+               a,
+               b,
+               stamps[a],
+               stamps[b],
+               target});
+}
+
+bool MeshSimplifier::collapse(const Collapse& c) {
+    const u32 keep = c.keep, remove = c.remove;
+    if (removed[keep] || removed[remove] || stamps[keep] != c.keep_stamp ||
+        stamps[remove] != c.remove_stamp) {
+        return false;
+    }
+
+    // only collapse if the two rings share exactly the vertices opposite
+    // the edge, anything else would pinch the surface
+    std::vector<u32> keep_ring{}, remove_ring{}, shared{};
+    neighbours(keep, keep_ring);
+    neighbours(remove, remove_ring);
+    std::set_intersection(keep_ring.begin(),
+                          keep_ring.end(),
+                          remove_ring.begin(),
+                          remove_ring.end(),
+                          std::back_inserter(shared));
+    size_t edge_faces = 0;
+    for (u32 f : vertex_faces[remove]) {
+        if (!face_removed[f] && has_vertex(f, keep)) {
+            edge_faces++;
+        }
+    }
+    if (edge_faces == 0 || shared.size() != edge_faces) {
+        return false;
+    }
+
+    // reject collapses that flip a remaining face
+    for (u32 v : {keep, remove}) {
+        for (u32 f : vertex_faces[v]) {
+            if (face_removed[f] || (has_vertex(f, keep) &&
+                                    has_vertex(f, remove))) {
+                continue;
+            }
+            const auto& face = faces[f];
+            Vec3 p[3], moved_p[3];
+            for (size_t k = 0; k < 3; k++) {
+                p[k] = positions[face[k]];
+                moved_p[k] = face[k] == v ? c.target : p[k];
+            }
+            Vec3 before = cross(p[1] - p[0], p[2] - p[0]);
+            Vec3 after =
+                cross(moved_p[1] - moved_p[0], moved_p[2] - moved_p[0]);
+            if (dot(before, after) <= 0) {
+                return false;
+            }
+        }
+    }
+
+    for (u32 f : vertex_faces[remove]) {
+        if (face_removed[f]) {
+            continue;
+        }
+        if (has_vertex(f, keep)) {
+            face_removed[f] = 1;
+            alive_faces--;
+            continue;
+        }
+        for (u32& v : faces[f]) {
+            if (v == remove) {
+                v = keep;
+            }
+        }
+        vertex_faces[keep].push_back(f);
+    }
+    auto& keep_faces = vertex_faces[keep];
+    keep_faces.erase(std::remove_if(keep_faces.begin(),
+                                    keep_faces.end(),
+                                    [&](u32 f) { return face_removed[f]; }),
+                     keep_faces.end());
+    vertex_faces[remove].clear();
+
+    if (!locked[keep]) {
+        positions[keep] = c.target;
+        moved[keep] = 1;
+    }
+    quadrics[keep] += quadrics[remove];
+    removed[remove] = 1;
+    stamps[keep]++;
+    stamps[remove]++;
+    max_cost = std::max(max_cost, c.cost);
+
+    neighbours(keep, keep_ring);
+    for (u32 v : keep_ring) {
+        push_edge(keep, v);
+    }
+    return true;
+}
+
+void MeshSimplifier::simplify_to(size_t target_faces) {
+    while (alive_faces > target_faces && !heap.empty()) {
+        Collapse c = heap.top();
+        heap.pop();
+        collapse(c);
+    }
+}
+
+// Faces of the current state. Vertices that moved since the last snapshot
+// are appended to vertex_data, the others keep the index they had, so
+// levels share every vertex that didn't move between them.
+std::vector<Vec3> MeshSimplifier::snapshot(std::vector<Vec3>& vertex_data) {
+    std::vector<Vec3> rtr{};
+    rtr.reserve(alive_faces);
+
+    for (u32 f = 0; f < faces.size(); f++) {
+        if (face_removed[f]) {
+            continue;
+        }
+        Vec3 face{};
+        for (int k = 0; k < 3; k++) {
+            u32 v = faces[f][static_cast<size_t>(k)];
+            if (moved[v]) {
+                index[v] = vertex_data.size();
+                vertex_data.push_back(positions[v]);
+                moved[v] = 0;
+            }
+            face[k] = static_cast<double>(index[v] + 1);
+        }
+        rtr.push_back(face);
+    }
+    return rtr;
+}
+
+LodStats build_lods(Scene& scene, int levels, double ratio) {
+    LodStats stats{};
+    stats.levels.assign(static_cast<size_t>(levels), {0, 0.0});
+
+    for (auto& obj : scene.objects) {
+        stats.triangles += obj.faces.size();
+        obj.lods.clear();
+        obj.lod_errors.clear();
+
+        // one collapse sequence per mesh, every level is a snapshot of it
+        MeshSimplifier simplifier{scene, obj};
+        double target = static_cast<double>(obj.faces.size());
+        for (auto& level : stats.levels) {
+            target *= ratio;
+            simplifier.simplify_to(static_cast<size_t>(target));
+            obj.lods.push_back(simplifier.snapshot(scene.vertex_data));
+            obj.lod_errors.push_back(sqrt(simplifier.max_cost));
+            level.triangles += obj.lods.back().size();
+            level.max_error = std::max(level.max_error, obj.lod_errors.back());
+        }
+    }
+
+    return stats;
+}
+
+} // namespace XmlRaytracer
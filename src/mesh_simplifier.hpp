@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include "scene.hpp"
+
+namespace XmlRaytracer {
+
+struct LodLevelStats {
+    size_t triangles;
+    // largest quadric error of any collapse up to this level, as a distance
+    double max_error;
+};
+
+struct LodStats {
+    size_t triangles;
+    // one entry per level, level 1 first
+    std::vector<LodLevelStats> levels;
+};
+
+// Builds `levels` progressively coarser versions of every mesh by quadric
+// edge collapse, each with about `ratio` times the triangles of the one
+// before. Levels are stored in Mesh::lods, vertices that moved are appended
+// to vertex_data. Boundary vertices are kept so open meshes don't shrink.
+LodStats build_lods(Scene& scene, int levels, double ratio);
+
+} // namespace XmlRaytracer
@@ -0,0 +1,138 @@
+#include "progressive.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <fmt/core.h>
+#include <vector>
+#include "fileio/ppm.hpp"
+
+namespace XmlRaytracer {
+
+static const int coarsest_step = 8;
+
+struct PassJob {
+    const Scene& scene;
+    const CameraRays& camera_rays;
+    ImageData& samples;
+    TraceOptions options;
+    int step;
+    bool abortable;
+    std::chrono::steady_clock::time_point deadline;
+
+    std::atomic<int> next_row;
+    std::atomic<bool> expired;
+    std::vector<TraceStats> worker_stats;
+};
+
+// Renders the pixels on the grid of this pass that no earlier, coarser
+// pass has rendered yet.
+static void pass_job(PassJob& job, int worker) {
+    const int step = job.step;
+    const int coarser = step * 2;
+    const bool first_pass = step == coarsest_step;
+    const int nx = job.camera_rays.nx;
+    const int ny = job.camera_rays.ny;
+
+    TraceState state{job.options, {}, 0};
+    const Color3 throughput{1.0, 1.0, 1.0};
+
+    for (int i = job.next_row++; i * step < ny; i = job.next_row++) {
+        int row = i * step;
+        // image rows go top to bottom, camera rows bottom to top
+        int y = ny - 1 - row;
+        state.rng_state = static_cast<u64>(y) + 1;
+
+        for (int x = 0; x < nx; x += step) {
+            if (!first_pass && row % coarser == 0 && x % coarser == 0) {
+                continue;
+            }
+            if (job.abortable &&
+                (job.expired ||
+                 std::chrono::steady_clock::now() >= job.deadline)) {
+                job.expired = true;
+                job.worker_stats[static_cast<size_t>(worker)] = state.stats;
+                return;
+            }
+
+            Ray ray = job.camera_rays.ray(x, y);
+            Color3 color = ray_color(ray, job.scene, state, 0, throughput);
+            job.samples(x, row) = PixelData{color};
+        }
+    }
+
+    job.worker_stats[static_cast<size_t>(worker)] = state.stats;
+}
+
+// Fills every pixel with the sample at the corner of its step x step block.
+static void upscale(const ImageData& samples, ImageData& preview, int step) {
+    for (int row = 0; row < samples.height; row++) {
+        for (int x = 0; x < samples.width; x++) {
+            preview(x, row) = samples(x - x % step, row - row % step);
+        }
+    }
+}
+
+// Writes next to the output and renames, so readers never see a partially
+// written pass.
+static bool write_pass(ImageData& preview, const std::string& output_path) {
+    std::string tmp_path = output_path + ".tmp";
+    if (!preview.write_ppm(tmp_path)) {
+        return false;
+    }
+    return std::rename(tmp_path.c_str(), output_path.c_str()) == 0;
+}
+
+ProgressiveResult
+render_progressive(const Scene& scene,
+                   const Camera& camera,
+                   const TraceOptions& options,
+                   ThreadPool& pool,
+                   std::chrono::steady_clock::time_point deadline,
+                   const std::string& output_path) {
+    const CameraRays camera_rays{camera};
+    const size_t pixel_count =
+        static_cast<size_t>(camera_rays.nx * camera_rays.ny);
+    ImageData samples{
+        camera_rays.nx, camera_rays.ny, std::vector<PixelData>(pixel_count)};
+    ImageData preview{
+        camera_rays.nx, camera_rays.ny, std::vector<PixelData>(pixel_count)};
+
+    ProgressiveResult result{0, 0, {}};
+    for (int step = coarsest_step; step >= 1; step /= 2) {
+        bool abortable = step != coarsest_step;
+        PassJob job{scene,
+                    camera_rays,
+                    samples,
+                    options,
+                    step,
+                    abortable,
+                    deadline,
+                    {0},
+                    {false},
+                    std::vector<TraceStats>(static_cast<size_t>(pool.size()))};
+
+        pool.run([&job](int worker) { pass_job(job, worker); });
+        for (const auto& stats : job.worker_stats) {
+            result.stats.add(stats);
+        }
+
+        if (job.expired) {
+            fmt::print("Time budget ran out during 1/{} resolution pass\n",
+                       step);
+            break;
+        }
+
+        upscale(samples, preview, step);
+        if (!write_pass(preview, output_path)) {
+            fmt::print("Couldn't write progressive pass to {}\n", output_path);
+            break;
+        }
+        result.step_reached = step;
+        result.passes_completed++;
+        fmt::print("Progressive pass at 1/{} resolution written\n", step);
+    }
+
+    return result;
+}
+
+} // namespace XmlRaytracer
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include "scene.hpp"
+#include "shading.hpp"
+#include "thread_pool.hpp"
+
+namespace XmlRaytracer {
+
+struct ProgressiveResult {
+    // pixel step of the last completed pass, 1 is full resolution
+    int step_reached;
+    int passes_completed;
+    TraceStats stats;
+};
+
+// Renders coarse to fine passes, first every 8th pixel in both directions
+// and then every 4th, 2nd and finally every pixel, reusing the samples of
+// earlier passes. Each completed pass is upscaled and written to
+// output_path as a valid image. Passes after the first stop at the
+// deadline; the first one always completes so there is always an image.
+ProgressiveResult
+render_progressive(const Scene& scene,
+                   const Camera& camera,
+                   const TraceOptions& options,
+                   ThreadPool& pool,
+                   std::chrono::steady_clock::time_point deadline,
+                   const std::string& output_path);
+
+} // namespace XmlRaytracer
@@ -0,0 +1,342 @@
+#include "rasterizer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace XmlRaytracer {
+
+// tile edge in pixels, every tile is rasterized by a single worker
+static const int tile_size = 32;
+// vertices closer than this to the eye, in multiples of the image plane
+// distance, send their triangle to the ray tested list
+static const double near_plane = 1e-3;
+// barycentric slack that makes coverage conservative
+static const double coverage_epsilon = 1e-7;
+// pixel slack of the bounding boxes used for binning
+static const double bounds_margin = 1e-6;
+// Rays through a triangle edge may hit the neighbour at the same depth,
+// Scene::hit decides these ties.
+static const double edge_tolerance = 1e-6;
+
+struct ProjectedTriangle {
+    double x[3], y[3];
+    // reciprocal ray parameter of every vertex, linear in screen space
+    double inv_t[3];
+    double inv_area;
+    int min_x, max_x, min_y, max_y;
+};
+
+// Maps points to continuous pixel coordinates, pixel (x, y) has its
+// center at (x + 0.5, y + 0.5). Handles non-orthogonal camera frames.
+struct Projection {
+    CameraRays rays;
+    Vec3 normal;
+    double plane_distance;
+    double uu, uv, vv, det;
+
+    explicit Projection(const Camera& camera) : rays(camera) {
+        normal = cross(rays.u, rays.v);
+        plane_distance = dot(normal, rays.image_corner - rays.e);
+        uu = dot(rays.u, rays.u);
+        uv = dot(rays.u, rays.v);
+        vv = dot(rays.v, rays.v);
+        det = uu * vv - uv * uv;
+    }
+
+    // ray parameter at which primary rays reach the depth of p
+    double ray_t(const Vec3& p) const {
+        return dot(normal, p - rays.e) / plane_distance;
+    }
+
+    void project(const Vec3& p, double t, double& x, double& y) const {
+        Vec3 r = rays.e + (p - rays.e) / t - rays.image_corner;
+        double ru = dot(r, rays.u);
+        double rv = dot(r, rays.v);
+        x = (ru * vv - rv * uv) / det / rays.pixel_width;
+        y = -(rv * uu - ru * uv) / det / rays.pixel_height;
+    }
+};
+
+static double
+edge(double ax, double ay, double bx, double by, double px, double py) {
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+enum class Projected { rasterized, ray_tested, culled };
+
+static Projected project_triangle(const Projection& projection,
+                                  const Triangle& tri,
+                                  ProjectedTriangle& out) {
+    const Vec3* vertices[3] = {&tri.v0, &tri.v1, &tri.v2};
+    double t[3];
+    for (int k = 0; k < 3; k++) {
+        t[k] = projection.ray_t(*vertices[k]);
+    }
+    // entirely behind the eye, no primary ray can reach it
+    if (t[0] <= 0 && t[1] <= 0 && t[2] <= 0) {
+        return Projected::culled;
+    }
+    if (std::min({t[0], t[1], t[2]}) <= near_plane) {
+        return Projected::ray_tested;
+    }
+
+    for (int k = 0; k < 3; k++) {
+        projection.project(*vertices[k], t[k], out.x[k], out.y[k]);
+        out.inv_t[k] = 1 / t[k];
+    }
+    double area =
+        edge(out.x[0], out.y[0], out.x[1], out.y[1], out.x[2], out.y[2]);
+    if (fabs(area) < epsilon) {
+        return Projected::ray_tested;
+    }
+    out.inv_area = 1 / area;
+
+    // pixels whose centers can lie inside, clamped to the image
+    const int nx = projection.rays.nx;
+    const int ny = projection.rays.ny;
+    double min_x = std::min({out.x[0], out.x[1], out.x[2]}) - 0.5;
+    double max_x = std::max({out.x[0], out.x[1], out.x[2]}) - 0.5;
+    double min_y = std::min({out.y[0], out.y[1], out.y[2]}) - 0.5;
+    double max_y = std::max({out.y[0], out.y[1], out.y[2]}) - 0.5;
+    if (max_x < -1 || max_y < -1 || min_x > nx || min_y > ny) {
+        return Projected::culled;
+    }
+    out.min_x = std::max(0, static_cast<int>(ceil(min_x - bounds_margin)));
+    out.max_x =
+        std::min(nx - 1, static_cast<int>(floor(max_x + bounds_margin)));
+    out.min_y = std::max(0, static_cast<int>(ceil(min_y - bounds_margin)));
+    out.max_y =
+        std::min(ny - 1, static_cast<int>(floor(max_y + bounds_margin)));
+    if (out.min_x > out.max_x || out.min_y > out.max_y) {
+        return Projected::culled;
+    }
+    return Projected::rasterized;
+}
+
+static void rasterize_triangle(const ProjectedTriangle& tri,
+                               u32 id,
+                               int x0,
+                               int x1,
+                               int y0,
+                               int y1,
+                               VisibilityBuffer& visibility) {
+    x0 = std::max(x0, tri.min_x);
+    x1 = std::min(x1, tri.max_x);
+    y0 = std::max(y0, tri.min_y);
+    y1 = std::min(y1, tri.max_y);
+
+    for (int y = y0; y <= y1; y++) {
+        double py = y + 0.5;
+        size_t row = static_cast<size_t>(y * visibility.width);
+        for (int x = x0; x <= x1; x++) {
+            double px = x + 0.5;
+            double w0 = edge(tri.x[1], tri.y[1], tri.x[2], tri.y[2], px, py) *
+                        tri.inv_area;
+            double w1 = edge(tri.x[2], tri.y[2], tri.x[0], tri.y[0], px, py) *
+                        tri.inv_area;
+            double w2 = 1 - w0 - w1;
+            if (w0 < -coverage_epsilon || w1 < -coverage_epsilon ||
+                w2 < -coverage_epsilon) {
+                continue;
+            }
+
+            double inv_t =
+                w0 * tri.inv_t[0] + w1 * tri.inv_t[1] + w2 * tri.inv_t[2];
+            double t = 1 / inv_t;
+            size_t i = row + static_cast<size_t>(x);
+            // strict test keeps the earlier triangle on ties, like Scene::hit
+            if (t < visibility.depth[i]) {
+                visibility.depth[i] = t;
+                visibility.triangles[i] = id;
+            }
+        }
+    }
+}
+
+bool VisibilityBuffer::empty() const {
+    return triangles.empty();
+}
+
+const Mesh& VisibilityBuffer::mesh(const Scene& scene, u32 id) const {
+    auto it = std::upper_bound(mesh_first.begin(), mesh_first.end(), id);
+    return scene.objects[static_cast<size_t>(it - mesh_first.begin()) - 1];
+}
+
+const Vec3& VisibilityBuffer::face(const Scene& scene, u32 id) const {
+    auto it = std::upper_bound(mesh_first.begin(), mesh_first.end(), id);
+    size_t index = static_cast<size_t>(it - mesh_first.begin()) - 1;
+    return scene.objects[index].faces[id - mesh_first[index]];
+}
+
+VisibilityRasterizer::VisibilityRasterizer(const Scene& render_scene,
+                                           const Camera& render_camera,
+                                           int chunks)
+    : scene(render_scene), camera(render_camera),
+      chunk_count(static_cast<size_t>(std::max(1, chunks))) {
+}
+
+VisibilityRasterizer::~VisibilityRasterizer() = default;
+
+// Allocates the buffer and work lists, done by whichever thread comes first.
+void VisibilityRasterizer::setup() {
+    visibility.width = camera.nx;
+    visibility.height = camera.ny;
+    size_t pixels =
+        static_cast<size_t>(camera.nx) * static_cast<size_t>(camera.ny);
+    visibility.triangles.assign(pixels, VisibilityBuffer::no_triangle);
+    visibility.depth.assign(pixels, infinity);
+
+    visibility.mesh_first.push_back(0);
+    for (const auto& obj : scene.objects) {
+        for (const auto& face : obj.faces) {
+            faces.push_back(&face);
+        }
+        visibility.mesh_first.push_back(static_cast<u32>(faces.size()));
+    }
+
+    tiles_x = (camera.nx + tile_size - 1) / tile_size;
+    const int tiles_y = (camera.ny + tile_size - 1) / tile_size;
+    tile_count = static_cast<size_t>(tiles_x * tiles_y);
+
+    projected.resize(faces.size());
+    bins.assign(chunk_count, std::vector<std::vector<u32>>(tile_count));
+    ray_tested.resize(chunk_count);
+}
+
+// Every chunk projects a contiguous range of triangles into its own bins,
+// reading the bins in chunk order keeps triangles in scene order.
+void VisibilityRasterizer::project_chunk(size_t chunk) {
+    const Projection projection{camera};
+    size_t begin = faces.size() * chunk / chunk_count;
+    size_t end = faces.size() * (chunk + 1) / chunk_count;
+    for (size_t id = begin; id < end; id++) {
+        ProjectedTriangle& tri = projected[id];
+        Projected result =
+            project_triangle(projection, scene.triangle(*faces[id]), tri);
+        if (result == Projected::ray_tested) {
+            ray_tested[chunk].push_back(static_cast<u32>(id));
+        }
+        if (result != Projected::rasterized) {
+            continue;
+        }
+        for (int ty = tri.min_y / tile_size; ty <= tri.max_y / tile_size;
+             ty++) {
+            for (int tx = tri.min_x / tile_size; tx <= tri.max_x / tile_size;
+                 tx++) {
+                bins[chunk][static_cast<size_t>(ty * tiles_x + tx)].push_back(
+                    static_cast<u32>(id));
+            }
+        }
+    }
+}
+
+void VisibilityRasterizer::rasterize_tile(size_t tile) {
+    int x0 = static_cast<int>(tile) % tiles_x * tile_size;
+    int y0 = static_cast<int>(tile) / tiles_x * tile_size;
+    int x1 = std::min(x0 + tile_size, camera.nx) - 1;
+    int y1 = std::min(y0 + tile_size, camera.ny) - 1;
+    for (const auto& chunk_bins : bins) {
+        for (u32 id : chunk_bins[tile]) {
+            rasterize_triangle(projected[id], id, x0, x1, y0, y1, visibility);
+        }
+    }
+}
+
+const VisibilityBuffer& VisibilityRasterizer::finish() {
+    std::call_once(setup_once, [this] { setup(); });
+
+    for (size_t chunk = next_chunk++; chunk < chunk_count;
+         chunk = next_chunk++) {
+        project_chunk(chunk);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (++chunks_done == chunk_count) {
+            for (const auto& ids : ray_tested) {
+                visibility.ray_tested.insert(
+                    visibility.ray_tested.end(), ids.begin(), ids.end());
+            }
+            stage_done.notify_all();
+        }
+    }
+    {
+        // tiles need the bins of every chunk
+        std::unique_lock<std::mutex> lock(mutex);
+        stage_done.wait(lock, [this] { return chunks_done == chunk_count; });
+    }
+
+    for (size_t tile = next_tile++; tile < tile_count; tile = next_tile++) {
+        rasterize_tile(tile);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (++tiles_done == tile_count) {
+            stage_done.notify_all();
+        }
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    stage_done.wait(lock, [this] { return tiles_done == tile_count; });
+    // intermediate state is only needed while rasterizing; swapped out,
+    // assigning {} would keep the memory
+    std::vector<ProjectedTriangle>().swap(projected);
+    std::vector<std::vector<std::vector<u32>>>().swap(bins);
+    std::vector<std::vector<u32>>().swap(ray_tested);
+    std::vector<const Vec3*>().swap(faces);
+    return visibility;
+}
+
+void VisibilityRasterizer::release() {
+    visibility = {};
+}
+
+VisibilityBuffer VisibilityRasterizer::take() {
+    return std::move(visibility);
+}
+
+VisibilityBuffer rasterize_visibility(const Scene& scene,
+                                      const Camera& camera,
+                                      ThreadPool& pool) {
+    VisibilityRasterizer rasterizer{scene, camera, pool.size()};
+    pool.run([&rasterizer](int) { rasterizer.finish(); });
+    return rasterizer.take();
+}
+
+HitResult primary_hit(const VisibilityBuffer& visibility,
+                      const Scene& scene,
+                      const Ray& ray,
+                      int x,
+                      int y) {
+    size_t i = static_cast<size_t>(y * visibility.width + x);
+    u32 closest = visibility.triangles[i];
+    double closest_t = infinity;
+    double t, u, v;
+
+    if (closest != VisibilityBuffer::no_triangle) {
+        const Vec3& face = visibility.face(scene, closest);
+        // conservative coverage may pick a triangle the ray misses
+        if (!scene.triangle(face).intersect(ray, t, u, v) || t <= 0 ||
+            u < edge_tolerance || v < edge_tolerance ||
+            1 - u - v < edge_tolerance) {
+            return scene.hit(ray, 0, infinity, false);
+        }
+        closest_t = t;
+    }
+
+    for (u32 id : visibility.ray_tested) {
+        const Vec3& face = visibility.face(scene, id);
+        if (!scene.triangle(face).intersect(ray, t, u, v) || t <= 0) {
+            continue;
+        }
+        if (t < closest_t || (t == closest_t && id < closest)) {
+            closest_t = t;
+            closest = id;
+        }
+    }
+
+    if (closest == VisibilityBuffer::no_triangle) {
+        return HitResult::no_hit();
+    }
+    return scene.make_hit(ray,
+                          visibility.mesh(scene, closest),
+                          visibility.face(scene, closest),
+                          closest_t);
+}
+
+} // namespace XmlRaytracer
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+namespace XmlRaytracer {
+
+// Closest triangle and its ray parameter per pixel, found by rasterizing
+// the scene through a camera. Indexed like the G-buffer, camera row y
+// times nx plus x.
+struct VisibilityBuffer {
+    static constexpr u32 no_triangle = ~0u;
+
+    int width = 0, height = 0;
+    std::vector<u32> triangles;
+    std::vector<double> depth;
+    // Triangles reaching behind the near plane, or projecting to a line,
+    // can't be rasterized reliably and are ray tested for every pixel.
+    std::vector<u32> ray_tested;
+    // global id of the first triangle of every mesh, plus the total count
+    std::vector<u32> mesh_first;
+
+    bool empty() const;
+
+    // mesh and face of a global triangle id
+    const Mesh& mesh(const Scene& scene, u32 id) const;
+    const Vec3& face(const Scene& scene, u32 id) const;
+};
+
+struct ProjectedTriangle;
+
+// Rasterization of one camera split into work items that any number of
+// threads can pick up: projecting ranges of triangles into screen tile
+// bins, then z-buffering the tiles. Lets a render's own workers build the
+// buffer of a target when they first reach it, instead of rasterizing
+// every target up front. Coverage is slightly conservative so that no
+// pixel a primary ray would hit is missed.
+class VisibilityRasterizer {
+  public:
+    // chunks is the number of triangle ranges projected independently
+    VisibilityRasterizer(const Scene& scene, const Camera& camera, int chunks);
+    ~VisibilityRasterizer();
+
+    VisibilityRasterizer(const VisibilityRasterizer&) = delete;
+    VisibilityRasterizer& operator=(const VisibilityRasterizer&) = delete;
+
+    // Works on the rasterization together with every other thread calling
+    // it and returns once the buffer is complete.
+    const VisibilityBuffer& finish();
+    // Frees the buffer once no thread uses it anymore.
+    void release();
+    // Moves the finished buffer out.
+    VisibilityBuffer take();
+
+  private:
+    void setup();
+    void project_chunk(size_t chunk);
+    void rasterize_tile(size_t tile);
+
+    const Scene& scene;
+    const Camera& camera;
+    const size_t chunk_count;
+    VisibilityBuffer visibility;
+
+    std::once_flag setup_once;
+    std::vector<const Vec3*> faces;
+    std::vector<ProjectedTriangle> projected;
+    // chunk, tile, triangle ids in scene order
+    std::vector<std::vector<std::vector<u32>>> bins;
+    std::vector<std::vector<u32>> ray_tested;
+    int tiles_x = 0;
+    size_t tile_count = 0;
+
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<size_t> next_tile{0};
+    std::mutex mutex;
+    std::condition_variable stage_done;
+    size_t chunks_done = 0;
+    size_t tiles_done = 0;
+};
+
+// Projects every triangle through the camera and z-buffers them into
+// screen tiles, in parallel on the pool.
+VisibilityBuffer rasterize_visibility(const Scene& scene,
+                                      const Camera& camera,
+                                      ThreadPool& pool);
+
+// Primary hit of the camera ray through pixel (x, y) from the visibility
+// buffer, equal to Scene::hit(ray, 0, infinity, false). The rasterized
+// triangle is confirmed with an exact ray test, pixels where that fails
+// fall back to tracing the whole scene.
+HitResult primary_hit(const VisibilityBuffer& visibility,
+                      const Scene& scene,
+                      const Ray& ray,
+                      int x,
+                      int y);
+
+} // namespace XmlRaytracer
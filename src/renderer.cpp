@@ -0,0 +1,203 @@
+#include "renderer.hpp"
+
+#include <algorithm>
+#include <fmt/core.h>
+#include <memory>
+
+namespace XmlRaytracer {
+
+void CancellationToken::cancel() {
+    cancelled = true;
+}
+
+bool CancellationToken::is_cancelled() const {
+    return cancelled;
+}
+
+// Shared state of a single Renderer::render call.
+struct RenderJob {
+    const Scene& scene;
+    const std::vector<RenderTarget>& targets;
+    std::vector<CameraRays> camera_rays;
+    // per target, null unless primary visibility is rasterized; built
+    // when the first row of the target is rendered and freed after its last
+    std::vector<std::unique_ptr<VisibilityRasterizer>> rasterizers;
+    std::vector<std::atomic<int>> rows_left;
+    std::vector<std::once_flag> started;
+    const RenderCallbacks& callbacks;
+    const CancellationToken* cancel;
+    TraceOptions options;
+    // global index of the first row of each target, plus the total row count
+    std::vector<int> first_row;
+
+    std::atomic<int> next_row;
+    std::atomic<int> rows_done;
+    std::vector<TraceStats> worker_stats;
+};
+
+// Renders one image row of a target and reports it finished.
+static void render_row(RenderJob& job,
+                       const RenderTarget& target,
+                       size_t index,
+                       int row,
+                       TraceState& state) {
+    const Scene& scene = job.scene;
+    const CameraRays& camera_rays = job.camera_rays[index];
+    static const VisibilityBuffer no_visibility{};
+    VisibilityRasterizer* rasterizer = job.rasterizers[index].get();
+    const VisibilityBuffer& visibility =
+        rasterizer ? rasterizer->finish() : no_visibility;
+    const int nx = camera_rays.nx;
+    const Color3 throughput{1.0, 1.0, 1.0};
+
+    // image rows go top to bottom, camera rows bottom to top
+    int y = camera_rays.ny - 1 - row;
+    state.rng_state = static_cast<u64>(y) + 1;
+    PixelData* out = target.pixels + static_cast<size_t>(row * nx);
+
+    for (int x = 0; x < nx; x++) {
+        Ray ray = camera_rays.ray(x, y);
+
+        Color3 color;
+        if (target.gbuffer && target.reshade) {
+            size_t i = static_cast<size_t>(y * nx + x);
+            const HitResult& hr = target.gbuffer->samples[i];
+            color = hr.is_hit
+                        ? shade_hit(ray, hr, scene, state, 0, throughput)
+                        : scene.background;
+        } else if (target.gbuffer || !visibility.empty()) {
+            HitResult hr = visibility.empty()
+                               ? scene.hit(ray, 0, infinity, false)
+                               : primary_hit(visibility, scene, ray, x, y);
+            if (target.gbuffer) {
+                target.gbuffer->samples[static_cast<size_t>(y * nx + x)] =
+                    hr;
+            }
+            color = hr.is_hit
+                        ? shade_hit(ray, hr, scene, state, 0, throughput)
+                        : scene.background;
+        } else {
+            color = ray_color(ray, scene, state, 0, throughput);
+        }
+        out[x] = PixelData{color};
+    }
+
+    if (job.callbacks.row_finished) {
+        job.callbacks.row_finished(index, row);
+    }
+}
+
+// Pulls rows from the global queue until it is empty or cancelled.
+static void render_rows(RenderJob& job, int worker) {
+    const int total_rows = job.first_row.back();
+    TraceState state{job.options, {}, 0};
+
+    for (int global_row = job.next_row++; global_row < total_rows;
+         global_row = job.next_row++) {
+        if (job.cancel && job.cancel->is_cancelled()) {
+            break;
+        }
+
+        auto it = std::upper_bound(
+            job.first_row.begin(), job.first_row.end(), global_row);
+        size_t index = static_cast<size_t>(it - job.first_row.begin()) - 1;
+        const RenderTarget& target = job.targets[index];
+        const int row = global_row - job.first_row[index];
+
+        if (!target.skip_rows || !target.skip_rows[row]) {
+            if (job.callbacks.target_started) {
+                std::call_once(job.started[index],
+                               job.callbacks.target_started,
+                               index);
+            }
+            render_row(job, target, index, row, state);
+        }
+        if (--job.rows_left[index] == 0 && job.rasterizers[index]) {
+            job.rasterizers[index]->release();
+        }
+        int done = ++job.rows_done;
+        if (job.callbacks.progress) {
+            job.callbacks.progress(static_cast<double>(done) / total_rows);
+        }
+    }
+
+    job.worker_stats[static_cast<size_t>(worker)] = state.stats;
+}
+
+static int resolve_thread_count(int thread_count) {
+    if (thread_count > 0) {
+        return thread_count;
+    }
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+Renderer::Renderer(const Scene& render_scene,
+                   const RenderOptions& render_options)
+    : scene(render_scene), options(render_options),
+      pool(resolve_thread_count(render_options.thread_count)),
+      materials_valid(render_scene.materials_resolved()) {
+    if (!materials_valid) {
+        fmt::print("Scene materials aren't resolved, call "
+                   "Scene::resolve_materials() before rendering\n");
+    }
+}
+
+bool Renderer::valid() const {
+    return materials_valid;
+}
+
+ThreadPool& Renderer::thread_pool() {
+    return pool;
+}
+
+RenderResult Renderer::render(const std::vector<RenderTarget>& targets,
+                              const RenderCallbacks& callbacks,
+                              const CancellationToken* cancel) {
+    if (!materials_valid) {
+        return {false, {}};
+    }
+    RenderJob job{scene,
+                  targets,
+                  {},
+                  {},
+                  std::vector<std::atomic<int>>(targets.size()),
+                  std::vector<std::once_flag>(targets.size()),
+                  callbacks,
+                  cancel,
+                  options.trace,
+                  {0},
+                  {0},
+                  {0},
+                  {}};
+    for (size_t i = 0; i < targets.size(); i++) {
+        const RenderTarget& target = targets[i];
+        job.camera_rays.emplace_back(*target.camera);
+        bool traces_primary = !(target.gbuffer && target.reshade);
+        job.rasterizers.push_back(
+            options.rasterize_primary && traces_primary
+                ? std::make_unique<VisibilityRasterizer>(
+                      scene, *target.camera, pool.size())
+                : nullptr);
+        job.rows_left[i] = target.camera->ny;
+        job.first_row.push_back(job.first_row.back() + target.camera->ny);
+    }
+    job.worker_stats.resize(static_cast<size_t>(pool.size()));
+
+    pool.run([&job](int worker) { render_rows(job, worker); });
+
+    RenderResult result{job.rows_done == job.first_row.back(), {}};
+    for (const auto& stats : job.worker_stats) {
+        result.stats.add(stats);
+    }
+    return result;
+}
+
+RenderResult Renderer::render(const Camera& camera,
+                              PixelData* pixels,
+                              const RenderCallbacks& callbacks,
+                              const CancellationToken* cancel) {
+    std::vector<RenderTarget> targets{{&camera, pixels, nullptr, false}};
+    return render(targets, callbacks, cancel);
+}
+
+} // namespace XmlRaytracer
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "fileio/gbuffer.hpp"
+#include "fileio/ppm.hpp"
+#include "rasterizer.hpp"
+#include "scene.hpp"
+#include "shading.hpp"
+#include "thread_pool.hpp"
+
+namespace XmlRaytracer {
+
+struct RenderOptions {
+    // 0 uses every hardware thread
+    int thread_count = 0;
+    // Finds primary hits by rasterizing each target when its first row is
+    // rendered, shadow and reflection rays are still traced.
+    bool rasterize_primary = false;
+    TraceOptions trace;
+};
+
+// Lets the caller stop a running render from any thread. Rows already
+// being rendered are finished, the rest are skipped.
+struct CancellationToken {
+    std::atomic<bool> cancelled{false};
+
+    void cancel();
+    bool is_cancelled() const;
+};
+
+// One image to render, the pixel buffer is owned by the caller and holds
+// camera->nx * camera->ny pixels, top row first.
+struct RenderTarget {
+    const Camera* camera;
+    PixelData* pixels;
+    // optional primary-hit cache; with reshade set the cached hits are
+    // shaded instead of tracing primary rays, otherwise they are stored
+    GBuffer* gbuffer = nullptr;
+    bool reshade = false;
+    // optional, one flag per image row; rows flagged non-zero already hold
+    // their pixels, e.g. restored from a checkpoint, and aren't rendered
+    const u8* skip_rows = nullptr;
+};
+
+// Called from worker threads, must be thread safe.
+struct RenderCallbacks {
+    // fraction of all rows of all targets that are done, 0...1
+    std::function<void(double)> progress;
+    // a row of a target is complete and won't be written to again
+    std::function<void(size_t target, int row)> row_finished;
+    // Called once per target before its first row is rendered, its rows
+    // wait until it returns. May set up the target's G-buffer and change
+    // its reshade flag, so caches are only resident while in use.
+    std::function<void(size_t target)> target_started;
+};
+
+struct RenderResult {
+    // false if the render was cancelled before every row was done
+    bool completed;
+    TraceStats stats;
+};
+
+// Embeddable entry point of the renderer. Keeps a thread pool alive so
+// repeated renders don't pay for thread creation. The scene must outlive
+// the renderer and have its materials resolved; create_scene_from_xml does
+// that, scenes built in memory call Scene::resolve_materials(). A renderer
+// created for an unresolved scene is invalid and renders nothing.
+class Renderer {
+  public:
+    Renderer(const Scene& render_scene, const RenderOptions& render_options);
+
+    // false if the scene's materials weren't resolved
+    bool valid() const;
+
+    // Renders all targets, the rows of every target are scheduled in one
+    // work queue in target order. Blocks until done or cancelled.
+    RenderResult render(const std::vector<RenderTarget>& targets,
+                        const RenderCallbacks& callbacks = {},
+                        const CancellationToken* cancel = nullptr);
+
+    // Convenience for a single camera without G-buffer.
+    RenderResult render(const Camera& camera,
+                        PixelData* pixels,
+                        const RenderCallbacks& callbacks = {},
+                        const CancellationToken* cancel = nullptr);
+
+    ThreadPool& thread_pool();
+
+  private:
+    const Scene& scene;
+    RenderOptions options;
+    ThreadPool pool;
+    bool materials_valid;
+};
+
+} // namespace XmlRaytracer
@@ -1,45 +1,200 @@
 #include "scene.hpp"
 
+#include <algorithm>
+#include <fmt/core.h>
+#include "hash.hpp"
+
 namespace XmlRaytracer {
 
-const Material& Scene::find_material(int id) const {
+u64 Camera::hash() const {
+    Hasher hasher;
+    hasher.add(position);
+    hasher.add(gaze);
+    hasher.add(up);
+    hasher.add(l);
+    hasher.add(r);
+    hasher.add(t);
+    hasher.add(b);
+    hasher.add(distance);
+    hasher.add(nx);
+    hasher.add(ny);
+    return hasher.state;
+}
+
+CameraRays::CameraRays(const Camera& cam) {
+    const Vec3& w = -cam.gaze;
+    nx = cam.nx;
+    ny = cam.ny;
+    v = cam.up;
+    u = cross(v, w);
+    e = cam.position;
+    Vec3 image_center = e + (-w * cam.distance);
+    image_corner = image_center + cam.t * v + cam.l * u;
+    pixel_width = (cam.r - cam.l) / cam.nx;
+    pixel_height = (cam.t - cam.b) / cam.ny;
+}
+
+Ray CameraRays::ray(int x, int y) const {
+    double su = (x + 0.5) * pixel_width;
+    double sv = (y + 0.5) * pixel_height;
+    Vec3 s = image_corner + su * u - sv * v;
+    return {e, s - e};
+}
+
+const std::vector<Vec3>& Mesh::lod_faces(int level) const {
+    if (level <= 0 || lods.empty()) {
+        return faces;
+    }
+    return lods[std::min(static_cast<size_t>(level), lods.size()) - 1];
+}
+
+double Mesh::lod_error(int level) const {
+    if (level <= 0 || lod_errors.empty()) {
+        return 0.0;
+    }
+    return lod_errors[std::min(static_cast<size_t>(level), lod_errors.size()) -
+                      1];
+}
+
+u64 Scene::geometry_hash() const {
+    Hasher hasher;
+    for (const auto& vertex : vertex_data) {
+        hasher.add(vertex);
+    }
+    for (const auto& obj : objects) {
+        hasher.add(obj.id);
+        hasher.add(obj.material_id);
+        for (const auto& face : obj.faces) {
+            hasher.add(face);
+        }
+    }
+    return hasher.state;
+}
+
+int Scene::material_index(int id) const {
     auto it = find_if(materials.begin(),
                       materials.end(),
                       [&](const Material& m) { return m.id == id; });
-    return *it;
+    if (it == materials.end()) {
+        return -1;
+    }
+    return static_cast<int>(it - materials.begin());
+}
+
+static bool has_positive_component(const Vec3& v) {
+    return v.x > 0.0 || v.y > 0.0 || v.z > 0.0;
+}
+
+static u8 material_features(const Material& material) {
+    u8 features = 0;
+    if (has_positive_component(material.diffuse)) {
+        features |= material_diffuse;
+    }
+    if (has_positive_component(material.specular)) {
+        features |= material_specular;
+    }
+    if (has_positive_component(material.mirror_reflectance)) {
+        features |= material_mirror;
+    }
+    return features;
+}
+
+bool Scene::resolve_materials() {
+    for (auto& material : materials) {
+        material.features = material_features(material);
+    }
+
+    for (auto& obj : objects) {
+        int index = material_index(obj.material_id);
+        if (index < 0) {
+            fmt::print("Mesh {} refers to unknown material {}\n",
+                       obj.id,
+                       obj.material_id);
+            return false;
+        }
+        obj.material_index = static_cast<size_t>(index);
+    }
+    return true;
+}
+
+bool Scene::materials_resolved() const {
+    for (const auto& material : materials) {
+        if (material.features != material_features(material)) {
+            return false;
+        }
+    }
+    for (const auto& obj : objects) {
+        if (obj.material_index >= materials.size() ||
+            materials[obj.material_index].id != obj.material_id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Triangle Scene::triangle(const Vec3& face) const {
+    return {vertex_data[static_cast<size_t>(face.x - 1)],
+            vertex_data[static_cast<size_t>(face.y - 1)],
+            vertex_data[static_cast<size_t>(face.z - 1)]};
+}
+
+HitResult Scene::make_hit(const Ray& ray,
+                          const Mesh& obj,
+                          const Vec3& face,
+                          double t) const {
+    HitResult rtr{};
+    rtr.is_hit = true;
+    rtr.t = t;
+    rtr.point = ray.at(t);
+    rtr.normal = unit_vector(triangle(face).normal());
+    rtr.obj_id = obj.id;
+    rtr.material_id = obj.material_id;
+    rtr.material_index = obj.material_index;
+    for (int k = 0; k < 3; k++) {
+        rtr.vertices[k] = static_cast<u32>(face[k] - 1);
+    }
+    return rtr;
 }
 
 HitResult Scene::hit(const Ray& ray,
                      double t_min,
                      double t_max,
-                     bool abort_on_hit) const {
-    HitResult rtr{};
-    HitResult tmp{};
-    double last_closest = t_max;
+                     bool abort_on_hit,
+                     int lod,
+                     int origin_obj) const {
+    // candidate loop only tracks the closest t and which triangle it was,
+    // the rest of the hit record is filled in once at the end
+    const Mesh* closest_obj = nullptr;
+    const Vec3* closest_face = nullptr;
+    double closest_t = t_max;
+    double t, u, v;
 
     for (const auto& obj : objects) {
-        for (const auto& face : obj.faces) {
-            Vec3 v0 = vertex_data[static_cast<size_t>(face.x - 1)];
-            Vec3 v1 = vertex_data[static_cast<size_t>(face.y - 1)];
-            Vec3 v2 = vertex_data[static_cast<size_t>(face.z - 1)];
-            Triangle tri{v0, v1, v2};
-            tmp = tri.hit(ray);
-            tmp.point = ray.at(tmp.t);
-            tmp.obj_id = obj.id;
-            tmp.material_id = obj.material_id;
-            if (tmp.is_hit) {
-                if (tmp.t > t_min && tmp.t < last_closest) {
-                    last_closest = tmp.t;
-                    rtr = tmp;
-                    if (abort_on_hit) {
-                        return rtr;
-                    }
-                }
+        double obj_t_min = t_min;
+        if (lod > 0 && obj.id == origin_obj) {
+            obj_t_min = std::max(t_min, obj.lod_error(lod) / ray.d.length());
+        }
+        for (const auto& face : obj.lod_faces(lod)) {
+            if (!triangle(face).intersect(ray, t, u, v) || t <= obj_t_min ||
+                t >= closest_t) {
+                continue;
+            }
+            closest_t = t;
+            closest_obj = &obj;
+            closest_face = &face;
+            if (abort_on_hit) {
+                break;
             }
         }
+        if (abort_on_hit && closest_obj) {
+            break;
+        }
     }
 
-    return rtr;
+    if (!closest_obj) {
+        return HitResult::no_hit();
+    }
+    return make_hit(ray, *closest_obj, *closest_face, closest_t);
 }
 
 } // namespace XmlRaytracer
@@ -4,16 +4,33 @@
 #include <vector>
 #include <string>
 #include "triangle.hpp"
+#include "math/ray.hpp"
 
 namespace XmlRaytracer {
 
 struct Camera {
+    int id;
     Vec3 position;
     Vec3 gaze;
     Vec3 up;
     double l, r, t, b;
     double distance;
     int nx, ny;
+
+    u64 hash() const;
+};
+
+// Camera frame precomputed once per render, generates primary rays.
+struct CameraRays {
+    int nx, ny;
+    Vec3 u, v, e;
+    Vec3 image_corner;
+    double pixel_width, pixel_height;
+
+    explicit CameraRays(const Camera& cam);
+
+    // y counts camera rows, from the bottom of the image
+    Ray ray(int x, int y) const;
 };
 
 struct Light {
@@ -22,6 +39,12 @@ struct Light {
     Vec3 intensity;
 };
 
+enum MaterialFeature : u8 {
+    material_diffuse = 1 << 0,
+    material_specular = 1 << 1,
+    material_mirror = 1 << 2,
+};
+
 struct Material {
     int id;
     Vec3 ambient;
@@ -29,28 +52,71 @@ struct Material {
     Vec3 specular;
     int phong_exponent;
     Vec3 mirror_reflectance;
+    // MaterialFeature bits, selects the shading kernel
+    u8 features;
 };
 
 struct Mesh {
     int id;
     int material_id;
+    // index into Scene::materials, resolved when the scene is loaded
+    size_t material_index;
     std::vector<Vec3> faces;
+    // simplified versions of faces, lods[0] is level 1, coarser follow
+    std::vector<std::vector<Vec3>> lods;
+    // largest distance of every level's surface from the full detail one
+    std::vector<double> lod_errors;
+
+    // faces of a LOD level, 0 is full detail; levels beyond the coarsest
+    // one built give the coarsest
+    const std::vector<Vec3>& lod_faces(int level) const;
+    // geometric error of a LOD level, 0 for full detail
+    double lod_error(int level) const;
 };
 
 struct Scene {
     int max_raytrace_depth;
     Color3 background;
-    Camera camera;
+    // every camera is rendered to its own image
+    std::vector<Camera> cameras;
     Color3 ambient_light;
     std::vector<Light> lights;
     std::vector<Material> materials;
     std::vector<Vec3> vertex_data;
     std::vector<Mesh> objects;
 
+    // lod selects the Mesh::lod_faces level that is intersected. A ray
+    // leaving the surface of mesh origin_obj, a Mesh::id, ignores hits on
+    // that mesh closer than its level's error: they are the surface itself,
+    // displaced by simplification.
+    HitResult hit(const Ray& ray,
+                  double t_min,
+                  double t_max,
+                  bool abort_on_hit,
+                  int lod = 0,
+                  int origin_obj = -1) const;
+
+    // triangle of a face, faces hold 1-based indices into vertex_data
+    Triangle triangle(const Vec3& face) const;
+
+    // Full hit record for a ray known to hit face of obj at t.
     HitResult
-    hit(const Ray& ray, double t_min, double t_max, bool abort_on_hit) const;
+    make_hit(const Ray& ray, const Mesh& obj, const Vec3& face, double t) const;
+
+    // index of the material with given id in materials, -1 if there is none
+    int material_index(int id) const;
+
+    // Resolves mesh material ids to dense indices and computes material
+    // feature sets. Fails if a mesh refers to an unknown material.
+    bool resolve_materials();
+
+    // true if material indices and feature sets are as resolve_materials()
+    // leaves them for the current meshes and materials
+    bool materials_resolved() const;
 
-    const Material& find_material(int id) const;
+    // Fingerprint of everything primary visibility depends on besides the
+    // camera: vertices, faces and their object/material assignment.
+    u64 geometry_hash() const;
 };
 
 } // namespace XmlRaytracer
@@ -0,0 +1,226 @@
+#include "shading.hpp"
+
+#include <cmath>
+#include "light_visibility.hpp"
+
+namespace XmlRaytracer {
+
+void TraceStats::add(const TraceStats& other) {
+    adaptive_terminated += other.adaptive_terminated;
+    roulette_terminated += other.roulette_terminated;
+    visibility_baked += other.visibility_baked;
+    visibility_fallbacks += other.visibility_fallbacks;
+}
+
+double TraceState::next_random() {
+    // xorshift64*, good enough for roulette decisions
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    u64 bits = (rng_state * 2685821657736338717ull) >> 11;
+    return static_cast<double>(bits) * 0x1.0p-53;
+}
+
+// Half of a quantization step of PixelData, in the 0...255 color range.
+const double min_visible_contribution = 0.5;
+const double max_radiance = 255.0;
+
+// Phong exponents are integers, so square-and-multiply replaces pow().
+static double int_pow(double base, int exponent) {
+    if (exponent < 0) {
+        return pow(base, exponent);
+    }
+    double result = 1.0;
+    while (exponent) {
+        if (exponent & 1) {
+            result *= base;
+        }
+        base *= base;
+        exponent >>= 1;
+    }
+    return result;
+}
+
+// LOD level traced by rays of the given depth.
+static int reflection_lod(const TraceOptions& options, int depth) {
+    if (options.lod_depth < 0 || depth < options.lod_depth) {
+        return 0;
+    }
+    return depth - options.lod_depth + 1;
+}
+
+// One shading kernel per material feature set, so terms a material can't
+// contribute to are compiled out instead of evaluated per hit and light.
+template <bool Diffuse, bool Specular, bool Mirror>
+static Color3 shade_kernel(const Ray& ray,
+                           const HitResult& hr,
+                           const Material& material,
+                           const Scene& scene,
+                           TraceState& state,
+                           int depth,
+                           const Color3& throughput) {
+    Vec3 calculated_light = scene.ambient_light * material.ambient;
+
+    Vec3 cam_vector = unit_vector(-ray.d);
+
+    // light calculation, materials without diffuse and specular terms
+    // don't need any shadow rays
+    if constexpr (Diffuse || Specular) {
+        const LightVisibility* baked = state.options.light_visibility;
+        for (size_t l = 0; l < scene.lights.size(); l++) {
+            const Light& light = scene.lights[l];
+            Vec3 light_vector = light.position - hr.point;
+            double light_distance = light_vector.length();
+
+            // shadows, primary hits take the baked result where the
+            // corners of their triangle agree; their exact fallback uses full
+            // detail like the bake, so neighbouring pixels see one geometry
+            const bool use_bake = baked && depth == 0;
+            LightVisibility::State visibility = LightVisibility::unknown;
+            if (use_bake) {
+                visibility = baked->lookup(hr, l);
+            }
+            if (visibility == LightVisibility::unknown) {
+                if (use_bake) {
+                    state.stats.visibility_fallbacks++;
+                }
+                int lod = use_bake ? 0 : state.options.shadow_lod;
+                if (is_shadowed(scene, hr.point, light, lod, hr.obj_id)) {
+                    continue;
+                }
+            } else {
+                state.stats.visibility_baked++;
+                if (visibility == LightVisibility::occluded) {
+                    continue;
+                }
+            }
+
+            // diffuse shading
+            if constexpr (Diffuse) {
+                double normal_dot_light = dot(hr.normal, light_vector);
+                double cos_theta = normal_dot_light /
+                                   (hr.normal.length() * light_vector.length());
+                if (normal_dot_light > 0) {
+                    calculated_light +=
+                        (light.intensity / (light_distance * light_distance)) *
+                        cos_theta * material.diffuse;
+                }
+            }
+
+            // specular shading
+            if constexpr (Specular) {
+                Vec3 half_vector = light_vector + cam_vector;
+                half_vector /= half_vector.length();
+                double normal_dot_half = dot(hr.normal, half_vector);
+                if (normal_dot_half > 0) {
+                    double cos_alpha = normal_dot_half / (hr.normal.length() *
+                                                          half_vector.length());
+                    cos_alpha = int_pow(cos_alpha, material.phong_exponent);
+                    calculated_light +=
+                        (light.intensity / (light_distance * light_distance)) *
+                        cos_alpha * material.specular;
+                }
+            }
+        }
+    }
+
+    // recursive reflection
+    if constexpr (Mirror) {
+        double cos_theta_reflect = dot(hr.normal, cam_vector) /
+                                   (hr.normal.length() * cam_vector.length());
+        Vec3 reflect_vector = (2 * hr.normal * cos_theta_reflect) - cam_vector;
+        Ray next_ray{hr.point + (reflect_vector * 0.000001), reflect_vector};
+        Color3 next_throughput = throughput * material.mirror_reflectance;
+        double survival = max_component(next_throughput);
+
+        bool terminate = false;
+        double weight = 1.0;
+        if (state.options.adaptive_termination &&
+            survival * max_radiance < min_visible_contribution) {
+            state.stats.adaptive_terminated++;
+            terminate = true;
+        } else if (state.options.russian_roulette_depth >= 0 &&
+                   depth + 1 >= state.options.russian_roulette_depth &&
+                   survival < 1.0) {
+            if (state.next_random() >= survival) {
+                state.stats.roulette_terminated++;
+                terminate = true;
+            } else {
+                weight = 1.0 / survival;
+            }
+        }
+
+        if (!terminate) {
+            Color3 reflect_color = ray_color(next_ray,
+                                             scene,
+                                             state,
+                                             depth + 1,
+                                             next_throughput * weight,
+                                             hr.obj_id);
+            calculated_light +=
+                weight * material.mirror_reflectance * reflect_color;
+        }
+    }
+
+    // clamp result in 0...255
+    for (int i = 0; i < 3; i++) {
+        if (calculated_light[i] > 255) {
+            calculated_light[i] = 255;
+        } else if (calculated_light[0] < 0) {
+            calculated_light[i] = 0;
+        }
+    }
+    return calculated_light;
+}
+
+using ShadeKernel = Color3 (*)(const Ray&,
+                              const HitResult&,
+                              const Material&,
+                              const Scene&,
+                              TraceState&,
+                              int,
+                              const Color3&);
+
+// indexed by Material::features
+static const ShadeKernel shade_kernels[] = {
+    shade_kernel<false, false, false>,
+    shade_kernel<true, false, false>,
+    shade_kernel<false, true, false>,
+    shade_kernel<true, true, false>,
+    shade_kernel<false, false, true>,
+    shade_kernel<true, false, true>,
+    shade_kernel<false, true, true>,
+    shade_kernel<true, true, true>,
+};
+
+Color3 shade_hit(const Ray& ray,
+                 const HitResult& hr,
+                 const Scene& scene,
+                 TraceState& state,
+                 int depth,
+                 const Color3& throughput) {
+    const Material& material = scene.materials[hr.material_index];
+    return shade_kernels[material.features](
+        ray, hr, material, scene, state, depth, throughput);
+}
+
+Color3 ray_color(const Ray& ray,
+                 const Scene& scene,
+                 TraceState& state,
+                 int depth,
+                 const Color3& throughput,
+                 int origin_obj) {
+    if (depth > scene.max_raytrace_depth) {
+        return {0.0, 0.0, 0.0};
+    }
+
+    int lod = reflection_lod(state.options, depth);
+    HitResult hr = scene.hit(ray, 0, infinity, false, lod, origin_obj);
+    if (!hr.is_hit) {
+        return scene.background;
+    }
+
+    return shade_hit(ray, hr, scene, state, depth, throughput);
+}
+
+} // namespace XmlRaytracer
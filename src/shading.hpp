@@ -0,0 +1,67 @@
+#pragma once
+
+#include "dev.h"
+#include "math/ray.hpp"
+#include "math/vec3.hpp"
+#include "scene.hpp"
+#include "triangle.hpp"
+
+namespace XmlRaytracer {
+
+struct LightVisibility;
+
+struct TraceOptions {
+    // End reflection bounces whose throughput can't change the 8-bit result.
+    bool adaptive_termination = true;
+    // Depth from which reflection bounces are russian rouletted, < 0 is off.
+    int russian_roulette_depth = -1;
+    // LOD level traced by shadow rays, 0 is full detail.
+    int shadow_lod = 0;
+    // Reflection rays of this depth and deeper trace one LOD level coarser
+    // per bounce, < 0 keeps full detail.
+    int lod_depth = -1;
+    // Baked per-vertex light visibility replacing shadow rays of primary
+    // hits, must match the scene. Not owned.
+    const LightVisibility* light_visibility = nullptr;
+};
+
+struct TraceStats {
+    u64 adaptive_terminated = 0;
+    u64 roulette_terminated = 0;
+    // light samples of primary hits answered by the bake, and those whose
+    // triangle corners disagreed and were traced exactly
+    u64 visibility_baked = 0;
+    u64 visibility_fallbacks = 0;
+
+    void add(const TraceStats& other);
+};
+
+// Per-thread tracing state, threaded through the recursion.
+struct TraceState {
+    TraceOptions options;
+    TraceStats stats;
+    u64 rng_state;
+
+    double next_random();
+};
+
+// origin_obj is the Mesh::id of the surface the ray leaves, -1 for
+// camera rays.
+Color3 ray_color(const Ray& ray,
+                 const Scene& scene,
+                 TraceState& state,
+                 int depth,
+                 const Color3& throughput,
+                 int origin_obj = -1);
+
+// Shades an already resolved hit, so cached primary hits can skip
+// Scene::hit entirely. throughput is the product of mirror reflectances
+// along the path that led to this hit.
+Color3 shade_hit(const Ray& ray,
+                 const HitResult& hr,
+                 const Scene& scene,
+                 TraceState& state,
+                 int depth,
+                 const Color3& throughput);
+
+} // namespace XmlRaytracer
@@ -0,0 +1,73 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace XmlRaytracer {
+
+// pool the current thread works for, null outside of workers
+static thread_local const ThreadPool* worker_pool = nullptr;
+
+ThreadPool::ThreadPool(int thread_count) {
+    thread_count = std::max(1, thread_count);
+    for (int i = 0; i < thread_count; i++) {
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::size() const {
+    return static_cast<int>(workers.size());
+}
+
+void ThreadPool::run(const std::function<void(int)>& task) {
+    assert(worker_pool != this && "ThreadPool::run called from a task");
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    current_task = &task;
+    busy = size();
+    generation++;
+    work_ready.notify_all();
+    work_done.wait(lock, [this] { return busy == 0; });
+    current_task = nullptr;
+}
+
+void ThreadPool::worker_loop(int index) {
+    worker_pool = this;
+    u64 seen_generation = 0;
+    while (true) {
+        const std::function<void(int)>* task = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [this, seen_generation] {
+                return stopping || generation != seen_generation;
+            });
+            if (stopping) {
+                return;
+            }
+            seen_generation = generation;
+            task = current_task;
+        }
+
+        (*task)(index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+        }
+        work_done.notify_all();
+    }
+}
+
+} // namespace XmlRaytracer
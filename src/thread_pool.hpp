@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "dev.h"
+
+namespace XmlRaytracer {
+
+// Fixed set of worker threads that is kept alive between renders.
+class ThreadPool {
+  public:
+    explicit ThreadPool(int thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const;
+
+    // Runs task(worker_index) once on every worker and blocks until all of
+    // them returned. Concurrent calls are serialized. Must not be called
+    // from inside a task of the same pool: the calling worker would wait
+    // for itself, so this deadlocks and is asserted against.
+    void run(const std::function<void(int)>& task);
+
+  private:
+    void worker_loop(int index);
+
+    std::vector<std::thread> workers;
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    const std::function<void(int)>* current_task = nullptr;
+    u64 generation = 0;
+    int busy = 0;
+    bool stopping = false;
+};
+
+} // namespace XmlRaytracer
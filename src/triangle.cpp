@@ -23,10 +23,10 @@ double Triangle::area() const {
     return area;
 }
 
-HitResult Triangle::hit(const Ray& ray) const {
-    HitResult rtr = HitResult::no_hit();
-    double t, u, v;
-
+bool Triangle::intersect(const Ray& ray,
+                         double& t,
+                         double& u,
+                         double& v) const {
     Vec3 v0v1 = v1 - v0;
     Vec3 v0v2 = v2 - v0;
     Vec3 point_vector = cross(ray.d, v0v2);
@@ -34,11 +34,11 @@ HitResult Triangle::hit(const Ray& ray) const {
 
 #ifdef CULLING
     if (determinant < epsilon) {
-        return rtr;
+        return false;
     }
 #else
     if (fabs(determinant) < epsilon) {
-        return rtr;
+        return false;
     }
 #endif
 
@@ -46,21 +46,30 @@ HitResult Triangle::hit(const Ray& ray) const {
     Vec3 tv = ray.o - v0;
     u = dot(tv, point_vector) * inv_determinant;
     if (u < 0 || u > 1) {
-        return rtr;
+        return false;
     }
 
     Vec3 qv = cross(tv, v0v1);
     v = dot(ray.d, qv) * inv_determinant;
     if (v < 0 || u + v > 1) {
-        return rtr;
+        return false;
     }
 
     t = dot(v0v2, qv) * inv_determinant;
+    return true;
+}
+
+HitResult Triangle::hit(const Ray& ray) const {
+    HitResult rtr = HitResult::no_hit();
+    double t, u, v;
+    if (!intersect(ray, t, u, v)) {
+        return rtr;
+    }
 
     rtr.is_hit = true;
     rtr.point = {u, v, 1 - u - v};
     rtr.t = t;
-    rtr.normal = unit_vector(normal()); // TODO: maybe convert to unit vector?
+    rtr.normal = unit_vector(normal());
 
     return rtr;
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include "dev.h"
 #include "math/vec3.hpp"
 #include "math/ray.hpp"
 
@@ -12,6 +14,9 @@ struct HitResult {
     double t;
     int obj_id;
     int material_id;
+    size_t material_index;
+    // vertex_data indices of the hit triangle's corners
+    u32 vertices[3];
 
     static HitResult no_hit();
 };
@@ -21,6 +26,9 @@ struct Triangle {
 
     double area() const;
     Vec3 normal() const;
+    // Intersection test only: on a hit stores the ray parameter t and the
+    // barycentric coordinates u, v of the hit point.
+    bool intersect(const Ray& ray, double& t, double& u, double& v) const;
     HitResult hit(const Ray& ray) const;
 };
 
@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+"""End-to-end scalability benchmark for xml-raytracer.
+
+Generates a fixed matrix of procedural scenes with scene-generator, renders
+each of them at 1, 2, 4 ... N threads and collects the per-stage timings and
+peak RSS that xml-raytracer reports through --stats-json. Results can be
+stored as a baseline and later runs compared against it.
+With --lod-args every scene is rendered once more with a level-of-detail
+policy to report its speedup and PSNR against the full detail image.
+
+    ./tools/benchmark.py --build-dir build --output results.json
+    ./tools/benchmark.py --build-dir build --skip-large
+    ./tools/benchmark.py --build-dir build --save-baseline baseline.json
+    ./tools/benchmark.py --build-dir build --baseline baseline.json \
+        --threshold render_ms=0.05 --threshold peak_rss_kb=0.2
+    ./tools/benchmark.py --build-dir build \
+        --lod-args "--lod-levels 3 --shadow-lod 2 --lod-depth 1"
+"""
+
+import argparse
+import hashlib
+import json
+import math
+import os
+import shlex
+import subprocess
+import sys
+
+# name: generator arguments
+DEFAULT_MATRIX = {
+    "1k-1mesh": dict(triangles=1000, meshes=1, lights=1, mirror_ratio=0.0,
+                     resolution="256x256"),
+    "10k-16mesh": dict(triangles=10000, meshes=16, lights=2, mirror_ratio=0.25,
+                       resolution="128x128"),
+    "100k-64mesh": dict(triangles=100000, meshes=64, lights=4,
+                        mirror_ratio=0.5, resolution="64x64"),
+    "1m-256mesh": dict(triangles=1000000, meshes=256, lights=4,
+                       mirror_ratio=0.25, resolution="64x64"),
+    "10m-1024mesh": dict(triangles=10000000, meshes=1024, lights=4,
+                         mirror_ratio=0.25, resolution="32x32"),
+}
+# scenes from this size on take minutes to hours and gigabytes,
+# --skip-large drops them
+LARGE_TRIANGLES = 1000000
+
+METRICS = ["load_ms", "build_ms", "render_ms", "write_ms", "peak_rss_kb"]
+DEFAULT_THRESHOLD = 0.10
+# differences below these are noise no matter the relative change
+ABSOLUTE_SLACK = {"peak_rss_kb": 1024.0}
+DEFAULT_SLACK_MS = 5.0
+
+
+def thread_counts(max_threads):
+    counts = []
+    n = 1
+    while n < max_threads:
+        counts.append(n)
+        n *= 2
+    counts.append(max_threads)
+    return counts
+
+
+def parse_scene(spec):
+    """name:triangles:meshes:lights:mirror_ratio:WxH"""
+    parts = spec.split(":")
+    if len(parts) != 6:
+        raise argparse.ArgumentTypeError(
+            "scene spec is name:triangles:meshes:lights:mirror_ratio:WxH")
+    name, triangles, meshes, lights, mirror_ratio, resolution = parts
+    return name, dict(triangles=int(triangles), meshes=int(meshes),
+                      lights=int(lights), mirror_ratio=float(mirror_ratio),
+                      resolution=resolution)
+
+
+def parse_threshold(spec):
+    metric, _, value = spec.partition("=")
+    if metric not in METRICS or not value:
+        raise argparse.ArgumentTypeError(
+            "threshold is metric=fraction, metric one of " + ", ".join(METRICS))
+    return metric, float(value)
+
+
+def file_digest(path):
+    digest = hashlib.sha256()
+    with open(path, "rb") as f:
+        for block in iter(lambda: f.read(1 << 20), b""):
+            digest.update(block)
+    return digest.hexdigest()
+
+
+def generate(generator, work_dir, name, params):
+    """Scenes are cached in work_dir next to a sidecar recording the params
+    and generator binary they came from; a mismatch regenerates them."""
+    path = os.path.join(work_dir, name + ".xml")
+    sidecar_path = os.path.join(work_dir, name + ".params.json")
+    source = {"params": params, "generator": file_digest(generator)}
+    if os.path.exists(path) and os.path.exists(sidecar_path):
+        with open(sidecar_path) as f:
+            if json.load(f) == source:
+                return path
+    subprocess.run([generator,
+                    "--triangles", str(params["triangles"]),
+                    "--meshes", str(params["meshes"]),
+                    "--lights", str(params["lights"]),
+                    "--mirror-ratio", str(params["mirror_ratio"]),
+                    "--resolution", params["resolution"],
+                    "--output", path],
+                   check=True, stdout=subprocess.DEVNULL)
+    with open(sidecar_path, "w") as f:
+        json.dump(source, f)
+    return path
+
+
+def render(renderer, work_dir, scene_path, threads, output="out.ppm",
+           extra_args=()):
+    stats_path = os.path.join(work_dir, "stats.json")
+    subprocess.run([renderer, scene_path,
+                    "--threads", str(threads),
+                    "--output", os.path.join(work_dir, output),
+                    "--stats-json", stats_path] + list(extra_args),
+                   check=True, stdout=subprocess.DEVNULL)
+    with open(stats_path) as f:
+        return json.load(f)
+
+
+def read_ppm(path):
+    with open(path) as f:
+        tokens = f.read().split()
+    return [int(t) for t in tokens[4:]]
+
+
+def psnr(reference_path, path):
+    reference, image = read_ppm(reference_path), read_ppm(path)
+    mse = sum((a - b) ** 2 for a, b in zip(reference, image)) / len(image)
+    return math.inf if mse == 0 else 10 * math.log10(255 * 255 / mse)
+
+
+def compare_lod(renderer, work_dir, name, scene_path, threads, lod_args):
+    full = render(renderer, work_dir, scene_path, threads, "full.ppm")
+    lod = render(renderer, work_dir, scene_path, threads, "lod.ppm", lod_args)
+    result = {
+        "name": name,
+        "render_ms": full["render_ms"],
+        "lod_render_ms": lod["render_ms"],
+        "speedup": full["render_ms"] / max(lod["render_ms"], 1e-3),
+        "psnr": psnr(os.path.join(work_dir, "full.ppm"),
+                     os.path.join(work_dir, "lod.ppm")),
+        "lod_levels": lod["lod_levels"],
+    }
+    print("{:<16} LOD render={:10.1f}ms -> {:10.1f}ms ({:.2f}x) "
+          "PSNR={:.2f}dB".format(name, result["render_ms"],
+                                 result["lod_render_ms"], result["speedup"],
+                                 result["psnr"]))
+    return result
+
+
+def compare(results, baseline, thresholds):
+    base = {(r["name"], r["threads"]): r for r in baseline["results"]}
+    regressions = []
+    for result in results:
+        key = (result["name"], result["threads"])
+        if key not in base:
+            continue
+        for metric in METRICS:
+            old, new = base[key][metric], result[metric]
+            limit = old * (1.0 + thresholds.get(metric, DEFAULT_THRESHOLD))
+            slack = ABSOLUTE_SLACK.get(metric, DEFAULT_SLACK_MS)
+            if new > limit and new - old > slack:
+                regressions.append((key, metric, old, new))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--build-dir", default="build",
+                        help="directory containing xml-raytracer and "
+                             "scene-generator")
+    parser.add_argument("--work-dir", default="benchmark_scenes",
+                        help="where generated scenes are cached")
+    parser.add_argument("--max-threads", type=int, default=os.cpu_count(),
+                        help="largest thread count to run (default: all)")
+    parser.add_argument("--scene", type=parse_scene, action="append",
+                        help="replaces the default matrix, "
+                             "name:triangles:meshes:lights:mirror_ratio:WxH")
+    parser.add_argument("--skip-large", action="store_true",
+                        help="leave out scenes of {} triangles or more"
+                             .format(LARGE_TRIANGLES))
+    parser.add_argument("--repeat", type=int, default=1,
+                        help="runs per configuration, the fastest one counts")
+    parser.add_argument("--output", help="write results to this json file")
+    parser.add_argument("--save-baseline", help="write results as baseline")
+    parser.add_argument("--baseline", help="compare against this baseline")
+    parser.add_argument("--threshold", type=parse_threshold, action="append",
+                        default=[],
+                        help="allowed relative slowdown per metric, e.g. "
+                             "render_ms=0.05 (default 0.10)")
+    parser.add_argument("--lod-args", type=shlex.split,
+                        help="renderer arguments of a LOD policy, every "
+                             "scene is also rendered with them and compared "
+                             "to full detail")
+    args = parser.parse_args()
+
+    renderer = os.path.join(args.build_dir, "xml-raytracer")
+    generator = os.path.join(args.build_dir, "scene-generator")
+    matrix = dict(args.scene) if args.scene else DEFAULT_MATRIX
+    if args.skip_large:
+        matrix = {name: params for name, params in matrix.items()
+                  if params["triangles"] < LARGE_TRIANGLES}
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    results = []
+    for name, params in matrix.items():
+        scene_path = generate(generator, args.work_dir, name, params)
+        for threads in thread_counts(args.max_threads):
+            runs = [render(renderer, args.work_dir, scene_path, threads)
+                    for _ in range(args.repeat)]
+            best = min(runs, key=lambda r: r["render_ms"])
+            best["name"] = name
+            results.append(best)
+            print("{:<16} threads={:<3} load={:9.1f}ms build={:9.1f}ms "
+                  "render={:10.1f}ms write={:8.1f}ms rss={}KiB".format(
+                      name, threads, best["load_ms"], best["build_ms"],
+                      best["render_ms"], best["write_ms"],
+                      best["peak_rss_kb"]))
+
+    report = {"matrix": matrix, "results": results}
+    if args.lod_args:
+        report["lod"] = [
+            compare_lod(renderer, args.work_dir, name,
+                        generate(generator, args.work_dir, name, params),
+                        args.max_threads, args.lod_args)
+            for name, params in matrix.items()]
+    for path in (args.output, args.save_baseline):
+        if path:
+            with open(path, "w") as f:
+                json.dump(report, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions = compare(results, baseline, dict(args.threshold))
+        for (name, threads), metric, old, new in regressions:
+            print("REGRESSION {} threads={} {}: {:.1f} -> {:.1f}".format(
+                name, threads, metric, old, new))
+        if regressions:
+            return 1
+        print("No regressions against " + args.baseline)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,263 @@
+#include "dev.h"
+#include "math/vec3.hpp"
+#include <fmt/core.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Writes procedural scene xml files for scalability benchmarks. Every mesh
+// is a UV sphere; spheres are laid out on a grid in front of the camera.
+
+namespace XmlRaytracer {
+
+struct GeneratorOptions {
+    long triangles = 1000;
+    int meshes = 1;
+    int lights = 1;
+    double mirror_ratio = 0.0;
+    int width = 800;
+    int height = 800;
+    int max_raytrace_depth = 6;
+    unsigned seed = 1;
+    std::string output = "generated.xml";
+};
+
+struct SphereMesh {
+    std::vector<Vec3> vertices;
+    std::vector<Vec3> faces; // 0 based, relative to vertices
+};
+
+static SphereMesh make_sphere(const Vec3& center, double radius, int rings) {
+    const double pi = 3.14159265358979323846;
+    const int segments = 2 * rings;
+    SphereMesh mesh{};
+
+    mesh.vertices.push_back(center + Vec3{0, radius, 0});
+    for (int i = 1; i < rings; i++) {
+        double theta = pi * i / rings;
+        for (int j = 0; j < segments; j++) {
+            double phi = 2 * pi * j / segments;
+            Vec3 offset{
+                sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi)};
+            mesh.vertices.push_back(center + radius * offset);
+        }
+    }
+    mesh.vertices.push_back(center - Vec3{0, radius, 0});
+
+    const int bottom = static_cast<int>(mesh.vertices.size()) - 1;
+    auto ring_vertex = [segments](int ring, int segment) {
+        return 1 + (ring - 1) * segments + segment % segments;
+    };
+    auto add_face = [&mesh, &center](int a, int b, int c) {
+        const auto& vs = mesh.vertices;
+        Vec3 v0 = vs[static_cast<size_t>(a)];
+        Vec3 v1 = vs[static_cast<size_t>(b)];
+        Vec3 v2 = vs[static_cast<size_t>(c)];
+        // renderer shades with the geometric normal, keep it pointing out
+        Vec3 normal = cross(v1 - v0, v2 - v0);
+        Vec3 centroid = (v0 + v1 + v2) / 3;
+        if (dot(normal, centroid - center) < 0) {
+            std::swap(b, c);
+        }
+        mesh.faces.push_back({static_cast<double>(a),
+                              static_cast<double>(b),
+                              static_cast<double>(c)});
+    };
+
+    for (int j = 0; j < segments; j++) {
+        add_face(0, ring_vertex(1, j), ring_vertex(1, j + 1));
+        add_face(bottom,
+                 ring_vertex(rings - 1, j),
+                 ring_vertex(rings - 1, j + 1));
+    }
+    for (int i = 1; i < rings - 1; i++) {
+        for (int j = 0; j < segments; j++) {
+            int a = ring_vertex(i, j);
+            int b = ring_vertex(i + 1, j);
+            int c = ring_vertex(i + 1, j + 1);
+            int d = ring_vertex(i, j + 1);
+            add_face(a, b, c);
+            add_face(a, c, d);
+        }
+    }
+
+    return mesh;
+}
+
+static void write_vec(FILE* fp, const char* tag, const Vec3& v) {
+    fmt::print(fp, "        <{}>{} {} {}</{}>\n", tag, v.x, v.y, v.z, tag);
+}
+
+static bool generate_scene(const GeneratorOptions& options) {
+    FILE* fp = fopen(options.output.c_str(), "w");
+    if (fp == NULL) {
+        fmt::print("Couldn't create scene file {}\n", options.output);
+        return false;
+    }
+
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    // sphere with r rings has 4r(r - 1) triangles
+    const double per_mesh = static_cast<double>(options.triangles) /
+                            static_cast<double>(options.meshes);
+    const int rings =
+        std::max(2, static_cast<int>(std::lround(0.5 + sqrt(per_mesh / 4))));
+
+    const int grid = static_cast<int>(std::ceil(sqrt(options.meshes)));
+    const double cell = 6.0 / grid;
+
+    fmt::print(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<scene>\n");
+    fmt::print(fp,
+               "    <maxraytracedepth>{}</maxraytracedepth>\n",
+               options.max_raytrace_depth);
+    fmt::print(fp, "    <background>20 20 30</background>\n");
+    fmt::print(fp,
+               "    <camera>\n"
+               "        <position>0 0 0</position>\n"
+               "        <gaze>0 0 -1</gaze>\n"
+               "        <up>0 1 0</up>\n"
+               "        <nearplane>-1 1 -1 1</nearplane>\n"
+               "        <neardistance>1</neardistance>\n"
+               "        <imageresolution>{} {}</imageresolution>\n"
+               "    </camera>\n",
+               options.width,
+               options.height);
+
+    fmt::print(fp, "    <lights>\n");
+    fmt::print(fp, "        <ambientlight>25 25 25</ambientlight>\n");
+    const double light_power = 30000.0 / options.lights;
+    for (int i = 0; i < options.lights; i++) {
+        Vec3 position{unit(rng) * 8 - 4, 2 + unit(rng) * 2, unit(rng) * 2 - 1};
+        fmt::print(fp, "        <pointlight id=\"{}\">\n", i + 1);
+        fmt::print(fp,
+                   "            <position>{} {} {}</position>\n",
+                   position.x,
+                   position.y,
+                   position.z);
+        fmt::print(fp,
+                   "            <intensity>{} {} {}</intensity>\n",
+                   light_power,
+                   light_power,
+                   light_power);
+        fmt::print(fp, "        </pointlight>\n");
+    }
+    fmt::print(fp, "    </lights>\n");
+
+    fmt::print(fp, "    <materials>\n");
+    for (int i = 0; i < options.meshes; i++) {
+        bool mirror = std::floor((i + 1) * options.mirror_ratio) >
+                      std::floor(i * options.mirror_ratio);
+        Vec3 color{unit(rng), unit(rng), unit(rng)};
+        fmt::print(fp, "    <material id=\"{}\">\n", i + 1);
+        write_vec(fp, "ambient", 0.2 * color);
+        write_vec(fp, "diffuse", color);
+        write_vec(fp, "specular", {0.8, 0.8, 0.8});
+        fmt::print(fp, "        <phongexponent>{}</phongexponent>\n", 20);
+        write_vec(fp,
+                  "mirrorreflectance",
+                  mirror ? Vec3{0.5, 0.5, 0.5} : Vec3{0, 0, 0});
+        fmt::print(fp, "    </material>\n");
+    }
+    fmt::print(fp, "    </materials>\n");
+
+    std::vector<SphereMesh> spheres{};
+    for (int i = 0; i < options.meshes; i++) {
+        Vec3 center{-3 + cell * (i % grid + 0.5),
+                    -3 + cell * (i / grid + 0.5),
+                    -4 - unit(rng)};
+        spheres.push_back(make_sphere(center, cell * 0.4, rings));
+    }
+
+    long triangle_count = 0;
+    fmt::print(fp, "    <vertexdata>\n");
+    for (const auto& sphere : spheres) {
+        for (const auto& v : sphere.vertices) {
+            fmt::print(fp, "        {} {} {}\n", v.x, v.y, v.z);
+        }
+    }
+    fmt::print(fp, "    </vertexdata>\n");
+
+    fmt::print(fp, "    <objects>\n");
+    long vertex_offset = 1;
+    for (size_t i = 0; i < spheres.size(); i++) {
+        fmt::print(fp, "        <mesh id=\"{}\">\n", i + 1);
+        fmt::print(fp, "            <materialid>{}</materialid>\n", i + 1);
+        fmt::print(fp, "            <faces>\n");
+        for (const auto& face : spheres[i].faces) {
+            fmt::print(fp,
+                       "                {} {} {}\n",
+                       static_cast<long>(face.x) + vertex_offset,
+                       static_cast<long>(face.y) + vertex_offset,
+                       static_cast<long>(face.z) + vertex_offset);
+        }
+        fmt::print(fp, "            </faces>\n");
+        fmt::print(fp, "        </mesh>\n");
+        vertex_offset += static_cast<long>(spheres[i].vertices.size());
+        triangle_count += static_cast<long>(spheres[i].faces.size());
+    }
+    fmt::print(fp, "    </objects>\n</scene>\n");
+
+    bool ok = ferror(fp) == 0;
+    fclose(fp);
+
+    fmt::print("Generated {}: {} triangles in {} meshes, {} lights, {}x{}\n",
+               options.output,
+               triangle_count,
+               options.meshes,
+               options.lights,
+               options.width,
+               options.height);
+    return ok;
+}
+
+} // namespace XmlRaytracer
+
+int main(int arg, char const* args[]) {
+    XmlRaytracer::GeneratorOptions options{};
+
+    bool valid = true;
+    for (int i = 1; i < arg; i++) {
+        std::string_view option = args[i];
+        if (i + 1 >= arg) {
+            valid = false;
+            break;
+        }
+        const char* value = args[++i];
+        if (option == "--triangles") {
+            options.triangles = atol(value);
+        } else if (option == "--meshes") {
+            options.meshes = atoi(value);
+        } else if (option == "--lights") {
+            options.lights = atoi(value);
+        } else if (option == "--mirror-ratio") {
+            options.mirror_ratio = atof(value);
+        } else if (option == "--resolution") {
+            valid =
+                sscanf(value, "%dx%d", &options.width, &options.height) == 2;
+        } else if (option == "--depth") {
+            options.max_raytrace_depth = atoi(value);
+        } else if (option == "--seed") {
+            options.seed = static_cast<unsigned>(atoi(value));
+        } else if (option == "--output") {
+            options.output = value;
+        } else {
+            valid = false;
+        }
+    }
+
+    if (!valid || options.triangles <= 0 || options.meshes <= 0 ||
+        options.lights <= 0 || options.width <= 0 || options.height <= 0) {
+        fmt::print("Correct usage of the program is: \"./scene-generator "
+                   "[--triangles n] [--meshes n] [--lights n] "
+                   "[--mirror-ratio 0...1] [--resolution WxH] [--depth n] "
+                   "[--seed n] [--output path]\"\n");
+        return -1;
+    }
+
+    return XmlRaytracer::generate_scene(options) ? 0 : -1;
+}